@@ -1,8 +1,20 @@
 #include <arch.h>
+#include <arch/mp.h>
+#include <arch/paca.h>
+#include <arch/ppc64.h>
 #include <lk/debug.h>
+#include <lk/main.h>
 
-void __WEAK arch_idle(void) {
-    asm volatile("nop");
+// in .data, r13 already points at cpu 0's before clear_bss and the trace hooks read it
+struct ppc64_paca ppc64_pacas[SMP_MAX_CPUS] __SECTION(".data");
+static uint8_t irq_stacks[SMP_MAX_CPUS][PPC64_IRQ_STACK_SIZE] __ALIGNED(16);
+
+// every cpu's, before the vectors go in and before the secondaries are started
+static void paca_init(void) {
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    ppc64_pacas[cpu].cpu_num = cpu;
+    ppc64_pacas[cpu].irq_sp = (uint64_t)&irq_stacks[cpu][PPC64_IRQ_STACK_SIZE];
+  }
 }
 
 void clear_bss(void) {
@@ -13,15 +25,22 @@ void clear_bss(void) {
 }
 
 void arch_early_init(void) {
+  paca_init();
+  ppc64_timebase_init();
+  ppc64_fdt_init((const void *)lk_boot_args[0]);
+  ppc64_exceptions_init();
+  ppc64_fpu_init();
 }
 
 void arch_init(void) {
+#if WITH_SMP
+  arch_mp_init_percpu();
+
+  // the platform starts the cpus, lk_secondary_cpu_entry() only needs the bootstrap threads to exist first
+  lk_init_secondary_cpus(ppc64_cpu_count() - 1);
+#endif
 }
 
 void arch_chain_load(void *entry, ulong arg0, ulong arg1, ulong arg2, ulong arg3) {
   panic("unimplemented");
 }
-
-void arch_clean_cache_range(addr_t start, size_t len) {
-  //PANIC_UNIMPLEMENTED;
-}
@@ -0,0 +1,174 @@
+#include <arch/defines.h>
+#include <arch/ppc64.h>
+#include <kernel/spinlock.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/list.h>
+#include <lk/trace.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOCAL_TRACE 0
+
+// buddy allocator for naturally aligned power of two runs of physical pages: HPTs, 16MB
+// large pages, framebuffers. the platform hands it RAM that the pmm and the heap don't manage
+// one free list per order, a free block is linked through its own first bytes (linear map,
+// va == pa) and its head page's entry in the arena's order map says free and which order,
+// so the buddy of a block being freed is checked and pulled off its list in O(1) and a
+// free coalesces upwards in O(log n)
+// blocks are aligned in physical addresses, not relative to the arena, so a 16MB block
+// really is a 16MB page
+
+#define BUDDY_ORDERS 14          // up to 32MB
+#define BUDDY_ARENAS 4
+#define BUDDY_FREE 0x80
+
+struct buddy_arena {
+  paddr_t base;
+  size_t pages;
+  uint8_t *order;                // per page, order | BUDDY_FREE on the head of a free block
+};
+
+static struct buddy_arena arenas[BUDDY_ARENAS];
+static uint arena_count;
+static struct list_node free_list[BUDDY_ORDERS];
+static size_t free_blocks[BUDDY_ORDERS];
+static spin_lock_t buddy_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static struct buddy_arena *arena_of(paddr_t pa) {
+  for (uint i = 0; i < arena_count; i++) {
+    if (pa >= arenas[i].base && (pa - arenas[i].base) / PAGE_SIZE < arenas[i].pages) return &arenas[i];
+  }
+  return NULL;
+}
+
+static inline uint8_t *order_entry(struct buddy_arena *a, paddr_t pa) {
+  return &a->order[(pa - a->base) / PAGE_SIZE];
+}
+
+static void block_insert(struct buddy_arena *a, paddr_t pa, uint order) {
+  *order_entry(a, pa) = order | BUDDY_FREE;
+  list_add_head(&free_list[order], (struct list_node *)pa);
+  free_blocks[order]++;
+}
+
+static void block_remove(struct buddy_arena *a, paddr_t pa, uint order) {
+  *order_entry(a, pa) = order;
+  list_delete((struct list_node *)pa);
+  free_blocks[order]--;
+}
+
+// before the heap, the order map comes out of the range itself
+status_t ppc64_buddy_add_arena(paddr_t base, size_t size) {
+  paddr_t end = ROUNDDOWN(base + size, PAGE_SIZE);
+  base = ROUNDUP(base, PAGE_SIZE);
+  if (arena_count == BUDDY_ARENAS || end <= base) return ERR_INVALID_ARGS;
+
+  if (!free_list[0].next) {
+    for (uint i = 0; i < BUDDY_ORDERS; i++) list_initialize(&free_list[i]);
+  }
+
+  struct buddy_arena *a = &arenas[arena_count];
+  a->base = base;
+  a->pages = (end - base) / PAGE_SIZE;
+  a->order = (uint8_t *)base;
+  memset(a->order, 0, a->pages);
+  paddr_t pa = ROUNDUP(base + a->pages, PAGE_SIZE);
+  if (pa >= end) return ERR_INVALID_ARGS;
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&buddy_lock, state);
+  arena_count++;
+  // the largest aligned block that fits, over and over
+  while (pa < end) {
+    uint order = BUDDY_ORDERS - 1;
+    while (order && ((pa & ((PAGE_SIZE << order) - 1)) || pa + (PAGE_SIZE << order) > end)) order--;
+    block_insert(a, pa, order);
+    pa += PAGE_SIZE << order;
+  }
+  spin_unlock_irqrestore(&buddy_lock, state);
+
+  dprintf(INFO, "buddy: 0x%lx-0x%lx, %zu pages\n", base, end, a->pages);
+  return NO_ERROR;
+}
+
+static uint order_for(size_t size) {
+  uint order = 0;
+  while (order < BUDDY_ORDERS && ((size_t)PAGE_SIZE << order) < size) order++;
+  return order;
+}
+
+// size rounds up to a power of two pages and the block is aligned to it
+void *ppc64_buddy_alloc(size_t size) {
+  uint order = order_for(size);
+  if (!arena_count || order >= BUDDY_ORDERS) return NULL;
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&buddy_lock, state);
+  uint k = order;
+  while (k < BUDDY_ORDERS && list_is_empty(&free_list[k])) k++;
+  if (k == BUDDY_ORDERS) {
+    spin_unlock_irqrestore(&buddy_lock, state);
+    return NULL;
+  }
+
+  paddr_t pa = (paddr_t)free_list[k].next;
+  struct buddy_arena *a = arena_of(pa);
+  block_remove(a, pa, k);
+  // hand the upper halves back until the block is the size asked for
+  while (k > order) {
+    k--;
+    block_insert(a, pa + (PAGE_SIZE << k), k);
+  }
+  *order_entry(a, pa) = order;
+  spin_unlock_irqrestore(&buddy_lock, state);
+
+  LTRACEF("order %u at 0x%lx\n", order, pa);
+  return (void *)pa;
+}
+
+void ppc64_buddy_free(void *ptr, size_t size) {
+  paddr_t pa = (paddr_t)ptr;
+  uint order = order_for(size);
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&buddy_lock, state);
+  struct buddy_arena *a = arena_of(pa);
+  DEBUG_ASSERT(a && *order_entry(a, pa) == order);
+
+  // merge while the buddy is free and whole, it can't be free at some other order and
+  // still be our buddy
+  while (order < BUDDY_ORDERS - 1) {
+    paddr_t buddy = pa ^ (PAGE_SIZE << order);
+    if (arena_of(buddy) != a || *order_entry(a, buddy) != (order | BUDDY_FREE)) break;
+    block_remove(a, buddy, order);
+    *order_entry(a, buddy) = 0;
+    *order_entry(a, pa) = 0;
+    pa &= ~(paddr_t)(PAGE_SIZE << order);
+    order++;
+  }
+  block_insert(a, pa, order);
+  spin_unlock_irqrestore(&buddy_lock, state);
+}
+
+size_t ppc64_buddy_free_pages(void) {
+  size_t pages = 0;
+  for (uint i = 0; i < BUDDY_ORDERS; i++) pages += free_blocks[i] << i;
+  return pages;
+}
+
+static int cmd_buddy(int argc, const console_cmd_args *argv) {
+  for (uint i = 0; i < arena_count; i++) {
+    printf("arena 0x%lx, %zu pages\n", arenas[i].base, arenas[i].pages);
+  }
+  for (uint i = 0; i < BUDDY_ORDERS; i++) {
+    if (free_blocks[i]) printf("%6zu KB: %zu free\n", ((size_t)PAGE_SIZE << i) >> 10, free_blocks[i]);
+  }
+  printf("%zu pages free\n", ppc64_buddy_free_pages());
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("buddy", "buddy allocator free blocks by order", &cmd_buddy)
+STATIC_COMMAND_END(buddy);
@@ -0,0 +1,73 @@
+#include <arch/defines.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <lk/debug.h>
+#include <string.h>
+
+// data/instruction cache maintenance by line
+// each range gets one trailing sync (and isync for the icache), never one per line
+// the 64 bit server ISA has no dcbi, invalidating goes through dcbf, so dirty lines are
+// written back first and nothing newer than memory ever gets thrown away
+
+// CACHE_LINE until the device tree reports the cpu's own
+static uint dcache_line = CACHE_LINE;
+static uint icache_line = CACHE_LINE;
+
+void ppc64_cache_set_line_size(uint dline, uint iline) {
+  // the loops below round down by masking
+  if (dline && !(dline & (dline - 1))) dcache_line = dline;
+  if (iline && !(iline & (iline - 1))) icache_line = iline;
+}
+
+uint ppc64_dcache_line_size(void) {
+  return dcache_line;
+}
+
+void arch_clean_cache_range(addr_t start, size_t len) {
+  for (addr_t a = start & ~(addr_t)(dcache_line - 1); a < start + len; a += dcache_line) {
+    __asm__ volatile("dcbst 0, %0" :: "r"(a) : "memory");
+  }
+  __asm__ volatile("sync" ::: "memory");
+}
+
+void arch_clean_invalidate_cache_range(addr_t start, size_t len) {
+  for (addr_t a = start & ~(addr_t)(dcache_line - 1); a < start + len; a += dcache_line) {
+    __asm__ volatile("dcbf 0, %0" :: "r"(a) : "memory");
+  }
+  __asm__ volatile("sync" ::: "memory");
+}
+
+void arch_invalidate_cache_range(addr_t start, size_t len) {
+  arch_clean_invalidate_cache_range(start, len);
+}
+
+// newly written code, the dcbst must all complete before the first icbi
+void arch_sync_cache_range(addr_t start, size_t len) {
+  for (addr_t a = start & ~(addr_t)(dcache_line - 1); a < start + len; a += dcache_line) {
+    __asm__ volatile("dcbst 0, %0" :: "r"(a) : "memory");
+  }
+  __asm__ volatile("sync" ::: "memory");
+  for (addr_t a = start & ~(addr_t)(icache_line - 1); a < start + len; a += icache_line) {
+    __asm__ volatile("icbi 0, %0" :: "r"(a) : "memory");
+  }
+  __asm__ volatile("sync\n isync" ::: "memory");
+}
+
+// dcbz the whole lines, plain stores for the partial ones at either end
+// cacheable memory only, dcbz on caching inhibited memory takes an alignment interrupt
+void ppc64_cache_zero_range(void *ptr, size_t len) {
+  addr_t start = (addr_t)ptr;
+  addr_t end = start + len;
+  addr_t first = ROUNDUP(start, dcache_line);
+  addr_t last = end & ~(addr_t)(dcache_line - 1);
+
+  if (first >= last) {
+    memset(ptr, 0, len);
+    return;
+  }
+  if (start != first) memset(ptr, 0, first - start);
+  for (addr_t a = first; a < last; a += dcache_line) {
+    __asm__ volatile("dcbz 0, %0" :: "r"(a) : "memory");
+  }
+  if (end != last) memset((void *)last, 0, end - last);
+}
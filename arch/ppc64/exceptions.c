@@ -0,0 +1,165 @@
+#include <arch/cpu_regs.h>
+#include <arch/iframe.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <kernel/thread.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/trace.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOCAL_TRACE 0
+
+// entry counts, per cpu, indexed by vector / 0x20
+// a row is a multiple of CACHE_LINE so cpus never share a line
+#define EXC_SLOTS 128
+static uint32_t exc_counts[SMP_MAX_CPUS][EXC_SLOTS] __ALIGNED(CACHE_LINE);
+
+static inline void exc_count(uint64_t vector) {
+  exc_counts[arch_curr_cpu_num()][(vector >> 5) & (EXC_SLOTS - 1)]++;
+}
+
+bool ppc64_in_irq(void) {
+  return PPC64_PACA_LWZ(irq_depth) != 0;
+}
+
+__WEAK enum handler_return platform_irq(struct ppc64_iframe *frame) {
+  return INT_NO_RESCHEDULE;
+}
+
+// fast path, only the volatile registers are in the frame, on the interrupt stack
+enum handler_return ppc64_irq(struct ppc64_iframe *frame) {
+  struct ppc64_paca *paca = ppc64_paca();
+  uint cpu = paca->cpu_num;
+  exc_count(frame->vector);
+  THREAD_STATS_INC(interrupts);
+  paca->irqs++;
+  paca->irq_depth++;
+
+  // woken from a nap/doze, dont go back to sleep on return
+  frame->srr1 &= ~(uint64_t)MSR_POW;
+
+  enum handler_return ret = INT_NO_RESCHEDULE;
+  switch (frame->vector) {
+    case 0x380:
+    case 0x480:
+      if (!ppc64_mmu_slb_miss(frame)) {
+        // r13-r31 arent in the frame on this path
+        ppc64_dump_iframe(frame);
+        panic("segment miss at 0x%llx on cpu %u, no aspace covers it\n",
+              frame->vector == 0x380 ? dar_read() : frame->srr0, cpu);
+      }
+      break;
+    case 0x500:
+      ret = platform_irq(frame);
+      break;
+    case 0x900:
+      ppc64_profile_tick(frame);
+      ret = ppc64_decrementer_irq();
+      if (ppc64_lazy_irq() == INT_RESCHEDULE) ret = INT_RESCHEDULE;
+      break;
+    case 0x980:
+      // nothing uses the hypervisor decrementer, park it
+      hdec_write(0x7fffffff);
+      break;
+    case 0xc00:
+      // only raised by the `exc bench` round trip
+      break;
+    case 0xf00:
+      ppc64_profile_tick(frame);
+      ppc64_pmu_irq(frame);
+      break;
+  }
+
+  paca->irq_depth--;
+  return ret;
+}
+
+// after ppc64_irq() asked for it, back on the interrupted thread's stack
+void ppc64_irq_preempt(struct ppc64_iframe *frame) {
+  ppc64_paca()->preempts++;
+  thread_preempt();
+  ppc64_fpu_fixup_frame(frame);
+}
+
+void ppc64_dump_iframe(const struct ppc64_iframe *frame) {
+  printf("vector 0x%llx srr0 0x%016llx srr1 0x%016llx\n", frame->vector, frame->srr0, frame->srr1);
+  printf("lr 0x%016llx ctr 0x%016llx cr 0x%08llx xer 0x%016llx\n", frame->lr, frame->ctr, frame->cr, frame->xer);
+  printf("dar 0x%016llx dsisr 0x%08llx\n", frame->dar, frame->dsisr);
+  for (int i = 0; i < 32; i += 4) {
+    printf("r%-2d 0x%016llx 0x%016llx 0x%016llx 0x%016llx\n", i,
+        frame->gpr[i], frame->gpr[i + 1], frame->gpr[i + 2], frame->gpr[i + 3]);
+  }
+}
+
+// slow path, full register state, anything returning from here resumes at frame->srr0
+void ppc64_exception(struct ppc64_iframe *frame) {
+  exc_count(frame->vector);
+
+  switch (frame->vector) {
+    case 0x300:
+    case 0x400:
+      if (ppc64_mmu_fault(frame)) return;
+      break;
+    case 0x800:
+      if (ppc64_fpu_unavailable(frame)) return;
+      break;
+    case 0xf20:
+      if (ppc64_vec_unavailable(frame)) return;
+      break;
+  }
+
+  // RI clear in SRR1 means the interrupt landed while SRR0/1 or the paca scratch were live
+  bool recoverable = frame->srr1 & MSR_RI;
+
+  ppc64_dump_iframe(frame);
+  panic("unhandled exception 0x%llx at 0x%llx on cpu %u%s\n", frame->vector, frame->srr0,
+        arch_curr_cpu_num(), recoverable ? "" : " (unrecoverable)");
+}
+
+void ppc64_exceptions_init(void) {
+  // XeLL leaves the decrementer ticking, park it before anyone enables EE
+  dec_write(0x7fffffff);
+  ppc64_install_vectors(msr_read() & MSR_HV);
+}
+
+static int cmd_exc(int argc, const console_cmd_args *argv) {
+  if (argc >= 2 && !strcmp(argv[1].str, "bench")) {
+    uint count = (argc >= 3) ? argv[2].u : 10000;
+    if (count == 0) count = 1;
+
+    // `sc` goes through the same fast entry/exit as the decrementer and ipis
+    uint64_t start = tbl_read();
+    for (uint i = 0; i < count; i++) {
+      __asm__ volatile("sc" ::: "memory");
+    }
+    uint64_t ticks = tbl_read() - start;
+    uint64_t ns = ticks * 1000 * 1000 * 1000 / ppc64_timebase_freq();
+    printf("%u round trips, %llu timebase ticks, %llu.%02llu ticks / %llu ns each\n", count, ticks,
+           ticks / count, (ticks * 100 / count) % 100, ns / count);
+    return 0;
+  }
+
+  printf("vector");
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) printf("  cpu%u     ", cpu);
+  printf("\n");
+  for (uint slot = 0; slot < EXC_SLOTS; slot++) {
+    bool any = false;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) any |= exc_counts[cpu][slot] != 0;
+    if (!any) continue;
+    printf("0x%03x ", slot << 5);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) printf(" %10u", exc_counts[cpu][slot]);
+    printf("\n");
+  }
+  printf("fast  ");
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) printf(" %10llu", ppc64_pacas[cpu].irqs);
+  printf("\npreemp");
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) printf(" %10llu", ppc64_pacas[cpu].preempts);
+  printf("\n");
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("exc", "exception counts, or `exc bench [n]` to time entry+exit", &cmd_exc)
+STATIC_COMMAND_END(exceptions);
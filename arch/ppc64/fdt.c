@@ -0,0 +1,268 @@
+#include <arch/ppc64.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/trace.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LOCAL_TRACE 0
+
+// flattened device tree from the loader, r3 at entry under pseries
+// one pass over the structure block at arch_early_init, before the heap, the vmm or the mmu,
+// so nothing is allocated and the blob is read in place. only what the arch and the platform
+// need is kept: memory nodes, how many hw threads the cpu nodes list, the first cpu's timebase,
+// cache block and SLB sizes, the hypervisor's HPT size and the RTAS start-cpu token
+// big endian only, cells are read as they sit
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+
+#define FDT_MAX_DEPTH 16
+
+struct fdt_header {
+  uint32_t magic;
+  uint32_t totalsize;
+  uint32_t off_dt_struct;
+  uint32_t off_dt_strings;
+  uint32_t off_mem_rsvmap;
+  uint32_t version;
+  uint32_t last_comp_version;
+  uint32_t boot_cpuid_phys;
+  uint32_t size_dt_strings;
+  uint32_t size_dt_struct;
+};
+
+enum fdt_node {
+  NODE_OTHER,
+  NODE_ROOT,
+  NODE_MEMORY,
+  NODE_CPUS,
+  NODE_CPU,
+  NODE_RTAS,
+};
+
+struct fdt_walk {
+  struct ppc64_fdt_info *info;
+  uint depth;
+  uint8_t node[FDT_MAX_DEPTH];
+  uint addr_cells, size_cells; // the root's, which /memory reg is in
+  uint threads;                // of the cpu node being walked
+  bool cpu_seen;               // the first cpu's properties are the ones kept
+};
+
+static struct ppc64_fdt_info fdt_info;
+static bool fdt_valid;
+
+static uint64_t fdt_cells(const uint32_t *p, uint n) {
+  uint64_t v = 0;
+  while (n--) v = v << 32 | *p++;
+  return v;
+}
+
+// unit address ignored, "memory@0" is "memory"
+static bool fdt_name_is(const char *name, const char *want) {
+  size_t len = strlen(want);
+  return !strncmp(name, want, len) && (name[len] == '\0' || name[len] == '@');
+}
+
+static enum fdt_node fdt_classify(const struct fdt_walk *w, const char *name) {
+  if (w->depth == 0) return NODE_ROOT;
+  if (w->depth == 1) {
+    if (fdt_name_is(name, "memory")) return NODE_MEMORY;
+    if (fdt_name_is(name, "cpus")) return NODE_CPUS;
+    if (fdt_name_is(name, "rtas")) return NODE_RTAS;
+  }
+  // /cpus holds nothing but cpus, qemu names them after the model ("PowerPC,970@0")
+  if (w->depth == 2 && w->node[1] == NODE_CPUS) return NODE_CPU;
+  return NODE_OTHER;
+}
+
+static void fdt_add_range(struct ppc64_fdt_range *r, uint *count, uint64_t base, uint64_t size) {
+  if (!size) return;
+  if (*count == PPC64_FDT_MEM_MAX) {
+    dprintf(INFO, "fdt: range 0x%llx+0x%llx dropped\n", base, size);
+    return;
+  }
+  r[*count].base = base;
+  r[*count].size = size;
+  (*count)++;
+}
+
+static void fdt_prop(struct fdt_walk *w, const char *name, const uint32_t *val, uint32_t len) {
+  struct ppc64_fdt_info *info = w->info;
+
+  switch (w->node[w->depth - 1]) {
+    case NODE_ROOT:
+      if (len == 4 && !strcmp(name, "#address-cells")) w->addr_cells = val[0];
+      if (len == 4 && !strcmp(name, "#size-cells")) w->size_cells = val[0];
+      break;
+    case NODE_MEMORY: {
+      uint entry = w->addr_cells + w->size_cells;
+      if (strcmp(name, "reg") || !entry || w->addr_cells > 2 || w->size_cells > 2) break;
+      for (uint i = 0; i + entry <= len / 4; i += entry) {
+        fdt_add_range(info->mem, &info->mem_count, fdt_cells(val + i, w->addr_cells),
+            fdt_cells(val + i + w->addr_cells, w->size_cells));
+      }
+      break;
+    }
+    case NODE_CPU:
+      if (!strcmp(name, "ibm,ppc-interrupt-server#s") && len >= 4) w->threads = len / 4;
+      if (w->cpu_seen) break;
+      if (!strcmp(name, "ibm,pft-size") && len == 8) {
+        info->pft_shift = val[1];
+      } else if (!strcmp(name, "timebase-frequency") && (len == 4 || len == 8)) {
+        info->timebase_freq = fdt_cells(val, len / 4);
+      } else if (len != 4) {
+        break;
+      } else if (!strcmp(name, "d-cache-block-size")) {
+        // dcbz works on the block, the line size only stands in when there is no block size
+        info->dcache_line = val[0];
+      } else if (!strcmp(name, "i-cache-block-size")) {
+        info->icache_line = val[0];
+      } else if (!strcmp(name, "d-cache-line-size") && !info->dcache_line) {
+        info->dcache_line = val[0];
+      } else if (!strcmp(name, "i-cache-line-size") && !info->icache_line) {
+        info->icache_line = val[0];
+      } else if (!strcmp(name, "slb-size") || !strcmp(name, "ibm,slb-size")) {
+        info->slb_size = val[0];
+      }
+      break;
+    case NODE_RTAS:
+      if (len == 4 && !strcmp(name, "start-cpu")) info->rtas_start_cpu = val[0];
+      break;
+    default:
+      break;
+  }
+}
+
+status_t ppc64_fdt_parse(const void *blob, struct ppc64_fdt_info *info) {
+  const struct fdt_header *h = blob;
+  memset(info, 0, sizeof(*info));
+
+  if (h->magic != FDT_MAGIC) return ERR_NOT_VALID;
+  if (h->version < 16 || h->last_comp_version > 17) return ERR_NOT_SUPPORTED;
+  uint32_t total = h->totalsize;
+  if (h->off_dt_struct >= total || h->off_dt_strings >= total || h->off_mem_rsvmap >= total ||
+      (h->off_dt_struct & 3) || (h->off_mem_rsvmap & 7)) {
+    return ERR_BAD_LEN;
+  }
+  info->blob = (uintptr_t)blob;
+  info->blob_size = total;
+
+  const uint8_t *base = blob;
+  const uint8_t *end = base + total;
+
+  // the memory reservation block, address and size pairs up to a zero size
+  for (const uint64_t *r = (const uint64_t *)(base + h->off_mem_rsvmap);
+       (const uint8_t *)(r + 2) <= end && r[1]; r += 2) {
+    fdt_add_range(info->rsv, &info->rsv_count, r[0], r[1]);
+  }
+
+  const char *strings = (const char *)base + h->off_dt_strings;
+  size_t strings_len = total - h->off_dt_strings;
+  const uint32_t *p = (const uint32_t *)(base + h->off_dt_struct);
+  struct fdt_walk w = { .info = info, .addr_cells = 2, .size_cells = 1 };
+
+  while ((const uint8_t *)(p + 1) <= end) {
+    switch (*p++) {
+      case FDT_BEGIN_NODE: {
+        const char *name = (const char *)p;
+        size_t len = strnlen(name, end - (const uint8_t *)name);
+        if (name + len == (const char *)end || w.depth == FDT_MAX_DEPTH) return ERR_NOT_VALID;
+        p += (len + 4) / 4;
+        w.node[w.depth] = fdt_classify(&w, name);
+        if (w.node[w.depth] == NODE_CPU) w.threads = 1;
+        w.depth++;
+        break;
+      }
+      case FDT_END_NODE:
+        if (!w.depth) return ERR_NOT_VALID;
+        if (w.node[--w.depth] == NODE_CPU) {
+          info->cpus += w.threads;
+          w.cpu_seen = true;
+        }
+        break;
+      case FDT_PROP: {
+        if ((const uint8_t *)(p + 2) > end || !w.depth) return ERR_NOT_VALID;
+        uint32_t len = p[0];
+        uint32_t nameoff = p[1];
+        const uint32_t *val = p + 2;
+        if (len > (size_t)(end - (const uint8_t *)val) || nameoff >= strings_len) return ERR_BAD_LEN;
+        p = val + (len + 3) / 4;
+        fdt_prop(&w, strings + nameoff, val, len);
+        break;
+      }
+      case FDT_NOP:
+        break;
+      case FDT_END:
+        return w.depth ? ERR_NOT_VALID : NO_ERROR;
+      default:
+        return ERR_NOT_VALID;
+    }
+  }
+  return ERR_BAD_LEN;
+}
+
+// from arch_early_init(), r3 is only believed once the header checks out
+void ppc64_fdt_init(const void *blob) {
+  if (!blob || ((uintptr_t)blob & 7)) return;
+
+  status_t err = ppc64_fdt_parse(blob, &fdt_info);
+  if (err < 0) {
+    LTRACEF("no device tree at %p: %d\n", blob, err);
+    return;
+  }
+  fdt_valid = true;
+
+  if (fdt_info.timebase_freq) ppc64_timebase_set_freq(fdt_info.timebase_freq);
+  ppc64_cache_set_line_size(fdt_info.dcache_line, fdt_info.icache_line);
+
+  dprintf(INFO, "fdt: %u bytes at %p, %llu MB in %u ranges, %u cpus\n", fdt_info.blob_size, blob,
+      ppc64_fdt_ram_end() >> 20, fdt_info.mem_count, fdt_info.cpus);
+}
+
+const struct ppc64_fdt_info *ppc64_fdt(void) {
+  return fdt_valid ? &fdt_info : NULL;
+}
+
+uint64_t ppc64_fdt_ram_end(void) {
+  uint64_t end = 0;
+  for (uint i = 0; fdt_valid && i < fdt_info.mem_count; i++) {
+    uint64_t e = fdt_info.mem[i].base + fdt_info.mem[i].size;
+    if (e > end) end = e;
+  }
+  return end;
+}
+
+uint ppc64_cpu_count(void) {
+  if (!fdt_valid || !fdt_info.cpus || fdt_info.cpus > SMP_MAX_CPUS) return SMP_MAX_CPUS;
+  return fdt_info.cpus;
+}
+
+static int cmd_fdt(int argc, const console_cmd_args *argv) {
+  const struct ppc64_fdt_info *f = ppc64_fdt();
+  if (!f) {
+    printf("no device tree\n");
+    return 0;
+  }
+  printf("blob 0x%llx, %u bytes\n", f->blob, f->blob_size);
+  for (uint i = 0; i < f->mem_count; i++) {
+    printf("memory 0x%llx-0x%llx\n", f->mem[i].base, f->mem[i].base + f->mem[i].size);
+  }
+  for (uint i = 0; i < f->rsv_count; i++) {
+    printf("reserved 0x%llx-0x%llx\n", f->rsv[i].base, f->rsv[i].base + f->rsv[i].size);
+  }
+  printf("%u cpus, timebase %llu Hz, cache blocks d %u i %u, slb %u, pft shift %u\n", f->cpus,
+      f->timebase_freq, f->dcache_line, f->icache_line, f->slb_size, f->pft_shift);
+  printf("rtas start-cpu 0x%x\n", f->rtas_start_cpu);
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("fdt", "what the device tree told us", &cmd_fdt)
+STATIC_COMMAND_END(fdt);
@@ -0,0 +1,74 @@
+#include <arch/cpu_regs.h>
+#include <arch/iframe.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <kernel/thread.h>
+#include <lk/debug.h>
+
+// lazy fp/vmx switching
+// a thread starts every timeslice with MSR.FP and MSR.VEC clear, and pays nothing unless it
+// touches those units. the first use traps (0x800 / 0xf20), the state is loaded and the unit
+// enabled in the trapping frame. on switch out, only state that was loaded gets saved, so the
+// copy in arch_thread is current whenever the thread is not running, on whichever cpu it lands next
+
+void ppc64_fp_save(void *fp);
+void ppc64_fp_restore(void *fp);
+void ppc64_vec_save(void *area, uint64_t vrsave);
+void ppc64_vec_restore(void *area, uint64_t vrsave);
+
+static inline void *vec_area(struct arch_thread *a) {
+  return (void *)ROUNDUP((uintptr_t)a->vec_area, 16);
+}
+
+void ppc64_fpu_switch(struct arch_thread *old, struct arch_thread *new) {
+  old->vrsave = vrsave_read();
+
+  if (old->fp_live) {
+    ppc64_fp_save(&old->fp);
+    old->fp_live = false;
+  }
+  if (old->vec_live) {
+    // compiled with -mvrsave, so VRSAVE covers every vector register live in the call chain
+    ppc64_vec_save(vec_area(old), old->vrsave);
+    old->vec_live = false;
+  }
+
+  if (new->vrsave != old->vrsave) vrsave_write(new->vrsave);
+}
+
+bool ppc64_fpu_unavailable(struct ppc64_iframe *frame) {
+  // the interrupted thread may have live state that an irq handler would clobber
+  if (ppc64_in_irq()) panic("fp used in interrupt context at 0x%llx\n", frame->srr0);
+
+  struct arch_thread *a = &get_current_thread()->arch;
+  ppc64_fp_restore(&a->fp);
+  a->fp_live = true;
+  frame->srr1 |= MSR_FP;
+  return true;
+}
+
+bool ppc64_vec_unavailable(struct ppc64_iframe *frame) {
+  if (ppc64_in_irq()) panic("vmx used in interrupt context at 0x%llx\n", frame->srr0);
+
+  // VRSAVE already has the bits of the trapping function, a superset of what was saved
+  struct arch_thread *a = &get_current_thread()->arch;
+  a->vrsave = vrsave_read();
+  ppc64_vec_restore(vec_area(a), a->vrsave);
+  a->vec_live = true;
+  frame->srr1 |= MSR_VEC;
+  return true;
+}
+
+// after a preemption from irq context the thread may have been switched out and back in,
+// in which case its state is in memory and the frame must not return with the units on
+void ppc64_fpu_fixup_frame(struct ppc64_iframe *frame) {
+  struct arch_thread *a = &get_current_thread()->arch;
+  if (!a->fp_live) frame->srr1 &= ~(uint64_t)MSR_FP;
+  if (!a->vec_live) frame->srr1 &= ~(uint64_t)MSR_VEC;
+}
+
+void ppc64_fpu_init(void) {
+  // firmware may hand over with the units on, make the boot thread trap like everyone else
+  uint64_t msr = msr_read() & ~(uint64_t)(MSR_FP | MSR_VEC);
+  __asm__ volatile("mtmsrd %0" : : "r"(msr) : "memory");
+}
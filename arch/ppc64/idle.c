@@ -0,0 +1,189 @@
+#include <arch.h>
+#include <arch/cpu_regs.h>
+#include <arch/hypercalls.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/init.h>
+#include <stdio.h>
+#include <string.h>
+
+// idle drivers, arch_idle() runs with ints enabled from the idle thread of each cpu
+// every driver checks for work with EE off and then sleeps in a way that turns EE back on
+// atomically, so an ipi or decrementer landing in between wakes it instead of being missed
+
+// 970 HID0, 64bit numbering, these are not the 603 style bits 22-24
+#define HID0_970_DOZE (1ULL << 55)
+#define HID0_970_NAP  (1ULL << 54)
+
+static bool work_pending(void) {
+#if WITH_SMP
+  return ppc64_mp_ipi_pending();
+#else
+  return false;
+#endif
+}
+
+// low SMT priority, the sibling hw thread gets nearly all of the issue slots
+static void idle_smt_low(void) {
+  ppc64_smt_priority_low();
+  for (int i = 0; i < 64 && !work_pending(); i++)
+    __asm__ volatile("nop");
+  ppc64_smt_priority_medium();
+}
+
+// pseries, H_CEDE gives the vcpu back to the hypervisor until an interrupt is pending
+// it sets MSR.EE itself, the interrupt is taken right after the hcall returns
+static void idle_cede(void) {
+  arch_disable_ints();
+  if (work_pending()) {
+    arch_enable_ints();
+    return;
+  }
+  do_hypercall4(H_CEDE, 0, 0, 0, 0);
+}
+
+// bare metal 970, MSR.POW with HID0 nap/doze set stops the core until dec or external
+// the interrupt handler clears POW in SRR1, so the return lands after the mtmsrd awake
+static void idle_pow(void) {
+  arch_disable_ints();
+  if (work_pending()) {
+    arch_enable_ints();
+    return;
+  }
+  uint64_t msr = msr_read() | MSR_POW | MSR_EE;
+  __asm__ volatile("sync\n mtmsrd %0\n isync" : : "r"(msr) : "memory");
+}
+
+static void hid0_write_970(uint64_t hid0) {
+  // the 970 wants the HID0 update followed by 6 reads
+  __asm__ volatile(
+    "sync\n mtspr 1008, %0\n"
+    "mfspr %0, 1008\n mfspr %0, 1008\n mfspr %0, 1008\n"
+    "mfspr %0, 1008\n mfspr %0, 1008\n mfspr %0, 1008\n"
+    "isync" : "+r"(hid0) : : "memory");
+}
+
+static void idle_nap_init(void) {
+  hid0_write_970((hid0_read() & ~HID0_970_DOZE) | HID0_970_NAP);
+}
+
+static void idle_doze_init(void) {
+  hid0_write_970((hid0_read() & ~HID0_970_NAP) | HID0_970_DOZE);
+}
+
+static const struct ppc64_idle_driver idle_drivers[] = {
+  { "spin", NULL, NULL },
+  { "smt-low", NULL, idle_smt_low },
+  { "cede", NULL, idle_cede },
+  { "nap", idle_nap_init, idle_pow },
+  { "doze", idle_doze_init, idle_pow },
+};
+
+static const struct ppc64_idle_driver *idle_driver = &idle_drivers[0];
+
+static bool cpu_is_970(void) {
+  switch (pvr_read() >> 16) {
+    case 0x0039: // 970
+    case 0x003c: // 970FX
+    case 0x0044: // 970MP
+    case 0x0045: // 970GX
+      return true;
+    default:
+      return false;
+  }
+}
+
+// H_CEDE only exists under a hypervisor, HID0 is only ours with MSR.HV and only laid out like
+// this on a 970
+static bool idle_usable(const struct ppc64_idle_driver *driver) {
+  bool hv = msr_read() & MSR_HV;
+  if (driver->idle == idle_cede) return !hv;
+  if (driver->idle == idle_pow) return hv && cpu_is_970();
+  return true;
+}
+
+// per cpu, from the PPC64_IPI_IDLE mailbox bit or directly on the calling cpu
+void ppc64_idle_sync(void) {
+  if (idle_driver->init) idle_driver->init();
+}
+
+void ppc64_idle_register(const struct ppc64_idle_driver *driver) {
+  idle_driver = driver;
+#if WITH_SMP
+  ppc64_mp_send_arch_ipi(mp.active_cpus & ~(1U << arch_curr_cpu_num()), PPC64_IPI_IDLE);
+#endif
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  ppc64_idle_sync();
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static const struct ppc64_idle_driver *idle_find(const char *name) {
+  for (size_t i = 0; i < countof(idle_drivers); i++) {
+    if (!strcmp(idle_drivers[i].name, name)) return &idle_drivers[i];
+  }
+  return NULL;
+}
+
+void __WEAK arch_idle(void) {
+#if WITH_SMP
+  ppc64_mp_poll_ipi();
+#endif
+#if WITH_KERNEL_VM
+  // zero a page for the pool instead of sleeping, the idle loop comes straight back
+  if (ppc64_zero_pool_idle()) return;
+#endif
+  if (idle_driver->idle) {
+    idle_driver->idle();
+  } else {
+    __asm__ volatile("nop");
+  }
+}
+
+static void idle_init(uint level) {
+  const char *name;
+  if (!(msr_read() & MSR_HV)) {
+    // not the hypervisor, so a pseries guest
+    name = "cede";
+  } else if (cpu_is_970()) {
+    name = "nap";
+  } else {
+    // xenon and anything unknown, still hand the core to the sibling thread
+    name = "smt-low";
+  }
+  // each cpu as it comes up, before any other is told about it
+  idle_driver = idle_find(name);
+  ppc64_idle_sync();
+}
+
+// HID0 is per core, so every cpu runs the driver init, here at boot and over an ipi when the
+// driver changes later
+LK_INIT_HOOK_FLAGS(ppc64_idle, idle_init, LK_INIT_LEVEL_ARCH_EARLY, LK_INIT_FLAG_ALL_CPUS);
+
+static int cmd_idle(int argc, const console_cmd_args *argv) {
+  if (argc < 2) {
+    printf("current: %s\navailable:", idle_driver->name);
+    for (size_t i = 0; i < countof(idle_drivers); i++) printf(" %s", idle_drivers[i].name);
+    printf("\n");
+    return 0;
+  }
+  const struct ppc64_idle_driver *driver = idle_find(argv[1].str);
+  if (!driver) {
+    printf("unknown idle driver '%s'\n", argv[1].str);
+    return -1;
+  }
+  if (!idle_usable(driver)) {
+    printf("idle driver '%s' can't run on this cpu\n", driver->name);
+    return -1;
+  }
+  ppc64_idle_register(driver);
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("idle", "show or select the idle driver", &cmd_idle)
+STATIC_COMMAND_END(idle);
@@ -1,41 +1,49 @@
 #pragma once
 
+#include <arch/paca.h>
+#include <arch/reg.h>
 #include <lk/compiler.h>
 #include <lk/debug.h>
 
+// mtmsrd with L=1 only writes EE and RI, keep RI set so an unordered interrupt stays recoverable
 static inline void arch_enable_ints(void) {
-  // TODO, only actually enable interrupts, when the codebase is ready to accept them
-  // Xell leaves the decrementer ticking, and will rudely interrupt/crash things
-  //__asm__ volatile("mtmsrd %0, 1": : "r"(0x200 | 0x8000));
+  __asm__ volatile("mtmsrd %0, 1": : "r"(MSR_EE | MSR_RI) : "memory");
 }
 static inline void arch_disable_ints(void) {
-  __asm__ volatile("mtmsrd %0, 1": : "r"(0x200));
+  __asm__ volatile("mtmsrd %0, 1": : "r"(MSR_RI) : "memory");
 }
 
 static inline struct thread *arch_get_current_thread(void) {
-  struct thread *thread_reg;
-  __asm__ volatile("add %0, %%r13, %1" : "=r"(thread_reg) : "r"(0));
-  //printf("arch_get_current_thread() == 0x%llx\n", (uint64_t)thread_reg);
-  return thread_reg;
+  return PPC64_PACA_LD(current_thread);
 }
 
 static inline void arch_set_current_thread(struct thread *t) {
-  //printf("arch_set_current_thread(0x%llx)\n", (uint64_t)t);
-  __asm__ volatile ("add %%r13, %0, %1" : : "r"(t), "r"(0));
+  PPC64_PACA_STD(current_thread, t);
 }
 
 static inline bool arch_ints_disabled(void) {
   uint32_t state;
 
   __asm__ volatile("mfmsr %0": "=r" (state));
-  return !(state & 0x8000);
+  return !(state & MSR_EE);
 }
 
 static inline uint arch_curr_cpu_num(void) {
-  return 0;
-  uint64_t pir;
-  __asm__("mfspr %0, 1023" : "=r"(pir));
-  return pir;
+  return PPC64_PACA_LWZ(cpu_num);
 }
 
-static inline ulong arch_cycle_count(void) { return 0; }
+// SMT thread priority hints (or rN,rN,rN nops), low while spinning so the sibling hw thread gets the core
+static inline void ppc64_smt_priority_low(void) {
+  __asm__ volatile("or 1,1,1" ::: "memory");
+}
+
+static inline void ppc64_smt_priority_medium(void) {
+  __asm__ volatile("or 2,2,2" ::: "memory");
+}
+
+// the timebase, not core cycles, but it is cheap, monotonic and synchronized across cpus
+static inline ulong arch_cycle_count(void) {
+  ulong tb;
+  __asm__ volatile("mftb %0" : "=r"(tb));
+  return tb;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <arch/pmu.h>
+#include <stdbool.h>
 #include <sys/types.h>
 
 struct arch_thread {
@@ -23,4 +25,23 @@ struct arch_thread {
   uint64_t r29; // 136
   uint64_t r30; // 144
   uint64_t r31; // 152
+  uint64_t msr; // 160, only IR and DR are switched
+
+  // everything below is switched in C, not by ppc64_context_switch
+  uint64_t vrsave;
+
+  // fp/vmx state is loaded on the first fp/vmx unavailable trap after a switch,
+  // and only saved on switch out if it was loaded, see fpu.c
+  // while *_live is set the registers hold the current values, otherwise the copy here does
+  bool fp_live;
+  bool vec_live;
+  struct {
+    uint64_t fpr[32];
+    uint64_t fpscr;
+  } fp;
+  uint8_t vec_area[32 * 16 + 16 + 15]; // v0-v31 then vscr, 16 byte aligned at runtime
+
+  // per thread performance counters, see pmu.c
+  bool pmu_counting;
+  uint64_t pmu_count[PMU_EVENT_COUNT];
 };
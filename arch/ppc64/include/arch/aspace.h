@@ -1,4 +1,16 @@
 #pragma once
 
+#include <sys/types.h>
+
+#define ARCH_ASPACE_SLB_CACHE 8
+
 struct arch_aspace {
+  uint64_t *pt_root; // software page table, the HPT caches it, see mmu.c
+  vaddr_t base;
+  size_t size;
+  uint flags;
+  uint context; // vsid context, 0 for the kernel, see mmu.c
+  volatile int cpu_mask; // cpus that have run it, whose TLBs may hold its translations
+  uint64_t slb_cache[ARCH_ASPACE_SLB_CACHE]; // recently missed segments, preloaded on switch
+  uint slb_cache_next;
 };
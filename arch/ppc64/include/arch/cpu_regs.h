@@ -1,8 +1,13 @@
 #pragma once
 
+#include <arch/reg.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+// MSR bits too wide for an immediate, the rest are in reg.h
+#define MSR_SF (1ULL << 63)
+#define MSR_HV (1ULL << 60)
+
 #define makereg(from, to, name) static inline uint64_t name ## _read(void) { \
   uint64_t t; \
   __asm__ volatile (#from " %0" : "=r"(t)); \
@@ -21,8 +26,15 @@ static inline void name ## _write(uint64_t value) { \
   __asm__ volatile ("mtspr " #id ", %0" : : "r"(value)); \
 }
 
+static inline uint64_t msr_read(void) {
+  uint64_t t;
+  __asm__ volatile ("mfmsr %0" : "=r"(t));
+  return t;
+}
+
+// no TLB maintenance here, stale translations are invalidated where the HPTE goes away
 static inline void msr_write(uint64_t value) {
-  __asm__ volatile ("tlbie %%r0, 0\nsync\nmtmsrd %0, 0\ntlbie %%r0, 0\nsync\nisync": : "r"(value));
+  __asm__ volatile ("sync\nmtmsrd %0, 0\nisync": : "r"(value) : "memory");
 }
 
 static inline void slbmte(uint64_t vsid, bool ks, bool kp, bool n, bool l, bool c, uint64_t esid, bool v, uint16_t index) {
@@ -52,6 +64,9 @@ make_spr(dsisr, 18);
 // data storage interupt status register, why a load/store causd a fault
 make_spr(dar, 19);
 // data address register, the addr that caused a fault
+make_spr(dec, 22); // decrementer, raises 0x900 when it goes negative
+make_spr(srr0, 26);
+make_spr(srr1, 27);
 make_spr(sdr1, 25); // 0x19, the physical addr that the root page table starts at
 // 0:4, htable size, must be 0-28
 // addr must be 256kb aligned
@@ -61,12 +76,29 @@ make_spr(sdr1, 25); // 0x19, the physical addr that the root page table starts a
 // see section 4.5 in book3
 // a PTEG (page table entry group?) is 8 PTE's totalling 128 bytes, 2x64bit each
 make_spr(uctrl, 136); // 0x88
+make_spr(vrsave, 256); // one bit per live vector register, maintained by -mvrsave prologues
 make_spr(ctrl, 152); // 0x98
 make_spr(pvr, 287);
 
+make_spr(hdec, 310); // hypervisor decrementer, raises 0x980
 make_spr(hrmor, 313); // HRMOR
+make_spr(hsrr0, 314);
+make_spr(hsrr1, 315);
 
 make_spr(lpcr, 318); // 0x13e
 
+// performance monitor, privileged numbers (the problem state copies are 16 lower)
+make_spr(mmcra, 786);
+make_spr(pmc1, 787);
+make_spr(pmc2, 788);
+make_spr(pmc3, 789);
+make_spr(pmc4, 790);
+make_spr(pmc5, 791);
+make_spr(pmc6, 792);
+make_spr(mmcr0, 795);
+make_spr(siar, 796); // sampled instruction address
+make_spr(sdar, 797); // sampled data address
+make_spr(mmcr1, 798);
+
 make_spr(hid0, 1008); //0x3f0, 1<<22=nap, 1<<23=doze, 1<<24=deepnap
 make_spr(pir, 1023);
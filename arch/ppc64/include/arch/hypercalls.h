@@ -1,13 +1,80 @@
 #pragma once
 
 // look for spapr_register_hypercall() in qemu
+#define H_REMOVE                0x04
 #define H_ENTER                 0x08
+#define H_READ                  0x0c
+#define H_PROTECT               0x18
+#define H_BULK_REMOVE           0x24
 #define H_GET_TERM_CHAR         0x54
 #define H_PUT_TERM_CHAR         0x58
+#define H_EOI                   0x64
+#define H_CPPR                  0x68
+#define H_IPI                   0x6c
+#define H_XIRR                  0x74
+#define H_CEDE                  0xe0
+
+// qemu specific, the RTAS blob in the DT is just `sc 1` with this opcode and r4 = struct rtas_args*
+#define KVMPPC_H_RTAS           0xf000
 
 uint64_t do_hypercall4(uint32_t opcode, uint64_t a, uint64_t b, uint64_t c, uint64_t d);
+// same, but also returns r4-r7 in ret[0..3]
+uint64_t do_hypercall_ret4(uint32_t opcode, uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t *ret);
+// args[0..7] go in r4-r11 and come back with whatever the hypervisor left there
+uint64_t do_hypercall_buf8(uint32_t opcode, uint64_t *args);
+
+// return codes
+#define H_SUCCESS         0
+#define H_HARDWARE        ((uint64_t)-1)
+#define H_PARAMETER       ((uint64_t)-4)
+#define H_PTEG_FULL       ((uint64_t)-6)
+#define H_NOT_FOUND       ((uint64_t)-7)
 
 #define H_EXACT           (1ULL<<(63-24))       /* Use exact PTE or return H_PTEG_FULL */
+#define H_READ_4          (1ULL<<(63-26))       /* Return 4 PTEs */
+#define H_AVPN            (1ULL<<(63-32))       /* An avpn is provided as a sanity test */
+
 static inline uint64_t h_enter(uint64_t flags, uint64_t ptex, uint64_t pte0, uint64_t pte1) {
   return do_hypercall4(H_ENTER, flags, ptex, pte0, pte1);
 }
+
+// the slot the hypervisor picked comes back in *slot
+static inline uint64_t h_enter_slot(uint64_t flags, uint64_t ptex, uint64_t pte0, uint64_t pte1, uint64_t *slot) {
+  uint64_t ret[4];
+  uint64_t rc = do_hypercall_ret4(H_ENTER, flags, ptex, pte0, pte1, ret);
+  *slot = ret[0];
+  return rc;
+}
+
+// with H_AVPN the entry only goes if its AVPN (pte0 & ~0x7f) matches
+static inline uint64_t h_remove(uint64_t flags, uint64_t ptex, uint64_t avpn) {
+  return do_hypercall4(H_REMOVE, flags, ptex, avpn, 0);
+}
+
+// rewrites pp, N and the key of an existing entry, flags carries them in the pte1 positions
+static inline uint64_t h_protect(uint64_t flags, uint64_t ptex, uint64_t avpn) {
+  return do_hypercall4(H_PROTECT, flags, ptex, avpn, 0);
+}
+
+// the four entries of ptex & ~3 into pte[0..7] as pte0/pte1 pairs
+static inline uint64_t h_read4(uint64_t ptex, uint64_t *pte) {
+  pte[0] = H_READ_4;
+  pte[1] = ptex;
+  return do_hypercall_buf8(H_READ, pte);
+}
+
+// up to four (tsh, tsl) requests, each tsh comes back with its own response code
+#define H_BULK_REMOVE_TYPE      0xc000000000000000ULL
+#define H_BULK_REMOVE_REQUEST   0x4000000000000000ULL
+#define H_BULK_REMOVE_RESPONSE  0x8000000000000000ULL
+#define H_BULK_REMOVE_END       0xc000000000000000ULL
+#define H_BULK_REMOVE_CODE      0x3000000000000000ULL
+#define H_BULK_REMOVE_SUCCESS   0x0000000000000000ULL
+#define H_BULK_REMOVE_NOT_FOUND 0x1000000000000000ULL
+#define H_BULK_REMOVE_AVPN      0x0200000000000000ULL
+#define H_BULK_REMOVE_PTEX      0x00ffffffffffffffULL
+#define H_BULK_REMOVE_MAX       4
+
+static inline uint64_t h_bulk_remove(uint64_t *args) {
+  return do_hypercall_buf8(H_BULK_REMOVE, args);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// exception frame, built on the interrupted stack below the ELFv2 protected zone
+// the fast path only fills the volatile state (r0-r12, lr, ctr, xer, cr, srr0/1)
+// the slow path also fills r14-r31, dar and dsisr
+
+#define IFRAME_GPR(n)       (8 * (n))
+#define IFRAME_LR           (8 * 32)
+#define IFRAME_CTR          (8 * 33)
+#define IFRAME_XER          (8 * 34)
+#define IFRAME_CR           (8 * 35)
+#define IFRAME_SRR0         (8 * 36)
+#define IFRAME_SRR1         (8 * 37)
+#define IFRAME_DAR          (8 * 38)
+#define IFRAME_DSISR        (8 * 39)
+#define IFRAME_VECTOR       (8 * 40)
+#define IFRAME_SCRATCH      (8 * 41)
+#define IFRAME_SIZE         (8 * 42)
+
+// back chain, cr, lr and toc save slots, so the C handler can spill lr into our frame
+#define EXC_FRAME_HEADER    32
+// leaf functions may be using the 288 bytes below r1
+#define EXC_PROTECTED_ZONE  288
+#define EXC_STACK_FRAME     (EXC_PROTECTED_ZONE + EXC_FRAME_HEADER + IFRAME_SIZE)
+
+#ifndef ASSEMBLY
+#include <stdint.h>
+
+struct ppc64_iframe {
+  uint64_t gpr[32];
+  uint64_t lr;
+  uint64_t ctr;
+  uint64_t xer;
+  uint64_t cr;
+  uint64_t srr0;
+  uint64_t srr1;
+  uint64_t dar;
+  uint64_t dsisr;
+  uint64_t vector;
+  uint64_t scratch; // target for the reservation clearing stdcx. on exit
+};
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+// per cpu data area, one cache line each
+// r13 points at this cpu's from the first instructions it runs (boot.S) and nothing writes r13
+// after that, it is the ELFv2 thread pointer and the compiler never allocates it. every field is
+// one ld or std off r13, in C, in the exception entry and in real mode alike (the array sits in
+// the kernel image, where va == pa)
+// offsets are shared with the asm, the struct below checks them
+
+#define PACA_CURRENT_THREAD 0
+#define PACA_CPU_NUM        8
+#define PACA_IRQ_DEPTH      12
+#define PACA_IRQ_SP         16
+#define PACA_EX_R3          24
+#define PACA_EX_CTR         32
+#define PACA_SLB            40
+#define PACA_IRQS           48
+#define PACA_PREEMPTS       56
+#define PACA_SIZE           128
+
+#define PPC64_IRQ_STACK_SIZE 8192
+
+#ifndef ASSEMBLY
+#include <arch/defines.h>
+#include <lk/compiler.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct thread;
+struct slb_cpu;
+
+struct ppc64_paca {
+  struct thread *current_thread;
+  uint32_t cpu_num;            // PIR
+  uint32_t irq_depth;          // nonzero while a fast path handler runs
+  uint64_t irq_sp;             // top of the stack fast path handlers run on
+  uint64_t ex_r3;              // exception entry scratch, live until the frame is built
+  uint64_t ex_ctr;
+  struct slb_cpu *slb;         // mmu.c's software copy of this cpu's SLB
+  uint64_t irqs;               // fast path entries
+  uint64_t preempts;           // of those, the ones that switched threads on the way out
+} __ALIGNED(CACHE_LINE);
+
+_Static_assert(offsetof(struct ppc64_paca, current_thread) == PACA_CURRENT_THREAD, "");
+_Static_assert(offsetof(struct ppc64_paca, cpu_num) == PACA_CPU_NUM, "");
+_Static_assert(offsetof(struct ppc64_paca, irq_depth) == PACA_IRQ_DEPTH, "");
+_Static_assert(offsetof(struct ppc64_paca, irq_sp) == PACA_IRQ_SP, "");
+_Static_assert(offsetof(struct ppc64_paca, ex_r3) == PACA_EX_R3, "");
+_Static_assert(offsetof(struct ppc64_paca, ex_ctr) == PACA_EX_CTR, "");
+_Static_assert(offsetof(struct ppc64_paca, slb) == PACA_SLB, "");
+_Static_assert(offsetof(struct ppc64_paca, irqs) == PACA_IRQS, "");
+_Static_assert(offsetof(struct ppc64_paca, preempts) == PACA_PREEMPTS, "");
+_Static_assert(sizeof(struct ppc64_paca) == PACA_SIZE, "");
+
+extern struct ppc64_paca ppc64_pacas[SMP_MAX_CPUS];
+
+static inline struct ppc64_paca *ppc64_paca(void) {
+  struct ppc64_paca *paca;
+  __asm__ volatile("mr %0, %%r13" : "=r"(paca));
+  return paca;
+}
+
+// single loads and stores, volatile so a read is never reused across a thread switch
+#define PPC64_PACA_LD(field) ({ \
+  uint64_t _v; \
+  __asm__ volatile("ld %0, %1(%%r13)" : "=r"(_v) : "i"(offsetof(struct ppc64_paca, field))); \
+  (__typeof__(((struct ppc64_paca *)0)->field))_v; \
+})
+
+#define PPC64_PACA_LWZ(field) ({ \
+  uint32_t _v; \
+  __asm__ volatile("lwz %0, %1(%%r13)" : "=r"(_v) : "i"(offsetof(struct ppc64_paca, field))); \
+  _v; \
+})
+
+#define PPC64_PACA_STD(field, v) \
+  __asm__ volatile("std %0, %1(%%r13)" :: "r"(v), "i"(offsetof(struct ppc64_paca, field)) : "memory")
+
+#define PPC64_PACA_STW(field, v) \
+  __asm__ volatile("stw %0, %1(%%r13)" :: "r"(v), "i"(offsetof(struct ppc64_paca, field)) : "memory")
+#endif
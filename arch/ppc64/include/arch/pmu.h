@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// generic events, mapped onto PMC1-4 by the per-cpu model table in pmu.c
+enum pmu_event {
+  PMU_CYCLES,
+  PMU_INSTRUCTIONS,
+  PMU_L1D_MISSES,
+  PMU_BRANCH_MISSES,
+  PMU_EVENT_COUNT,
+};
+
+struct pmu_counts {
+  uint64_t count[PMU_EVENT_COUNT];
+};
+
+struct thread;
+
+bool pmu_supported(void);
+const char *pmu_event_name(enum pmu_event event);
+
+// count a thread wherever it runs, the counters are saved and restored across context switches
+status_t pmu_thread_start(struct thread *t);
+void pmu_thread_read(struct thread *t, struct pmu_counts *counts);
+void pmu_thread_stop(struct thread *t, struct pmu_counts *counts);
+
+// count everything on the calling cpu, whichever thread runs
+status_t pmu_cpu_start(void);
+void pmu_cpu_read(struct pmu_counts *counts);
+void pmu_cpu_stop(struct pmu_counts *counts);
+
+// sampling, PMC1 raises 0xf00 every period cycles on every cpu, excludes counting sessions
+status_t pmu_sample_start(uint32_t period);
+void pmu_sample_stop(void);
+void pmu_sample_sync(void); // per cpu, applies the current sampling state
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct ppc64_iframe;
+
+// secondary cpu entry stub in boot.S, r3 holds the cpu number
+void _secondary_start(void);
+
+void ppc64_secondary_entry(uint cpu);
+void ppc64_mp_poll_ipi(void);
+bool ppc64_mp_ipi_pending(void);
+enum handler_return ppc64_mp_ipi_irq(void);
+
+// arch private mailbox bits, above the mp_ipi_t range
+#define PPC64_IPI_PROFILE 8
+#define PPC64_IPI_TLB 9
+#define PPC64_IPI_IDLE 10
+void ppc64_mp_send_arch_ipi(uint target_mask, uint bit);
+
+// exceptions.S / exceptions.c
+void ppc64_install_vectors(bool hv);
+void ppc64_exceptions_init(void);
+enum handler_return ppc64_irq(struct ppc64_iframe *frame);
+void ppc64_irq_preempt(struct ppc64_iframe *frame);
+void ppc64_exception(struct ppc64_iframe *frame);
+void ppc64_dump_iframe(const struct ppc64_iframe *frame);
+
+bool ppc64_in_irq(void);
+
+// timer.c
+enum handler_return ppc64_decrementer_irq(void);
+void ppc64_timebase_init(void);
+void ppc64_timebase_set_freq(uint64_t freq);
+uint64_t ppc64_timebase_freq(void);
+void ppc64_timer_set_sample_period(uint64_t ticks);
+void ppc64_timer_rearm(void);
+void ppc64_timebase_give(uint cpu);
+void ppc64_timebase_take(void);
+
+// fdt.c, what the loader's device tree says, read once at arch_early_init
+#define PPC64_FDT_MEM_MAX 8
+struct ppc64_fdt_range {
+  uint64_t base;
+  uint64_t size;
+};
+struct ppc64_fdt_info {
+  uint64_t blob;
+  uint32_t blob_size;
+  struct ppc64_fdt_range mem[PPC64_FDT_MEM_MAX]; // /memory reg
+  uint mem_count;
+  struct ppc64_fdt_range rsv[PPC64_FDT_MEM_MAX]; // memory reservation block
+  uint rsv_count;
+  uint cpus;                                      // hw threads over all cpu nodes
+  uint64_t timebase_freq;                         // the rest is the first cpu's, 0 when absent
+  uint dcache_line;
+  uint icache_line;
+  uint slb_size;
+  uint pft_shift;                                 // HPT size under an LPAR
+  uint32_t rtas_start_cpu;
+};
+status_t ppc64_fdt_parse(const void *blob, struct ppc64_fdt_info *info);
+void ppc64_fdt_init(const void *blob);
+const struct ppc64_fdt_info *ppc64_fdt(void);     // NULL without a device tree
+uint64_t ppc64_fdt_ram_end(void);
+uint ppc64_cpu_count(void);
+
+#if WITH_KERNEL_VM
+// the linear map gets at most the lower half of the kernel aspace, 4K regions the rest
+#define PPC64_LINEAR_MAX ((uint64_t)(KERNEL_ASPACE_BASE + KERNEL_ASPACE_SIZE) / 2)
+#else
+#define PPC64_LINEAR_MAX (1ULL << 40)
+#endif
+
+// buddy.c, naturally aligned power of two runs of physical pages
+status_t ppc64_buddy_add_arena(paddr_t base, size_t size);
+void *ppc64_buddy_alloc(size_t size);
+void ppc64_buddy_free(void *ptr, size_t size);
+size_t ppc64_buddy_free_pages(void);
+
+// cache.c
+void ppc64_cache_set_line_size(uint dline, uint iline);
+uint ppc64_dcache_line_size(void);
+void ppc64_cache_zero_range(void *ptr, size_t len);
+
+// fpu.c, lazy fp/vmx switching
+struct arch_thread;
+void ppc64_fpu_init(void);
+void ppc64_fpu_switch(struct arch_thread *old, struct arch_thread *new);
+bool ppc64_fpu_unavailable(struct ppc64_iframe *frame);
+bool ppc64_vec_unavailable(struct ppc64_iframe *frame);
+void ppc64_fpu_fixup_frame(struct ppc64_iframe *frame);
+
+// provided by the platform
+enum handler_return platform_irq(struct ppc64_iframe *frame); // 0x500
+void platform_send_ipi(uint cpu);
+
+// idle.c
+struct ppc64_idle_driver {
+  const char *name;
+  void (*init)(void); // per cpu setup, runs on every cpu
+  void (*idle)(void);
+};
+void ppc64_idle_register(const struct ppc64_idle_driver *driver);
+void ppc64_idle_sync(void);
+
+// pmu.c
+void ppc64_pmu_switch(struct arch_thread *old, struct arch_thread *new);
+void ppc64_pmu_irq(struct ppc64_iframe *frame);
+
+// profile.c
+void ppc64_profile_tick(const struct ppc64_iframe *frame);
+void ppc64_profile_sync(void);
+
+// trace.c, only with TRACE_FUNCTIONS
+struct thread;
+void ppc64_trace_switch(struct thread *newthread);
+
+// mmu.c
+struct arch_aspace;
+bool ppc64_mmu_fault(struct ppc64_iframe *frame);
+uint64_t ppc64_mmu_vsid(const struct arch_aspace *aspace, vaddr_t va);
+struct arch_aspace *ppc64_mmu_kernel_aspace(void);
+bool ppc64_mmu_slb_miss(struct ppc64_iframe *frame);
+// kernel memory backed on first touch, reads see zeroes until written
+// NULL without WITH_KERNEL_VM or with translation off
+void *ppc64_lazy_alloc(size_t size, uint arch_mmu_flags);
+void ppc64_lazy_free(void *ptr);
+enum handler_return ppc64_lazy_irq(void);
+
+// slab.c, cache line aligned objects with per cpu magazines
+void *ppc64_slab_alloc(size_t size);
+void ppc64_slab_free(void *ptr);
+
+// zeropool.c, pages zeroed from the idle loop (WITH_KERNEL_VM)
+#define PPC64_PMM_ALLOC_FLAG_ZEROED (1 << 0)
+struct vm_page;
+struct vm_page *ppc64_pmm_alloc_page(uint flags);
+bool ppc64_zero_pool_idle(void);
@@ -0,0 +1,32 @@
+#pragma once
+
+// SPR numbers, usable from both C and asm
+#define SPRN_XER        1
+#define SPRN_LR         8
+#define SPRN_CTR        9
+#define SPRN_DSISR      18
+#define SPRN_DAR        19
+#define SPRN_DEC        22
+#define SPRN_SRR0       26
+#define SPRN_SRR1       27
+#define SPRN_SPRG0      272
+#define SPRN_SPRG1      273
+#define SPRN_SPRG2      274
+#define SPRN_SPRG3      275 // readable from problem state, dont put anything private here
+#define SPRN_HSPRG0     304
+#define SPRN_HSPRG1     305
+#define SPRN_HDEC       310
+#define SPRN_HSRR0      314
+#define SPRN_HSRR1      315
+
+// MSR bits that fit in an immediate, the rest are in cpu_regs.h
+#define MSR_LE          (1 << 0)
+#define MSR_RI          (1 << 1)  // SRR0/1 hold nothing live, an unordered interrupt can be returned from
+#define MSR_DR          (1 << 4)
+#define MSR_IR          (1 << 5)
+#define MSR_ME          (1 << 12)
+#define MSR_FP          (1 << 13)
+#define MSR_PR          (1 << 14)
+#define MSR_EE          (1 << 15)
+#define MSR_POW         (1 << 18)
+#define MSR_VEC         (1 << 25)
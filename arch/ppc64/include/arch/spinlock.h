@@ -1,6 +1,8 @@
 #pragma once
 
 #include <arch/ops.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #define SPIN_LOCK_INITIAL_VALUE (0)
 
@@ -9,18 +11,60 @@ typedef unsigned int spin_lock_t;
 typedef unsigned int spin_lock_saved_state_t;
 typedef unsigned int spin_lock_save_flags_t;
 
+// ticket lock, fair under contention and every waiter spins on a read-only copy of the line
+// old is the RA of an addis, "b" keeps it out of r0, which addis would read as 0
+// upper halfword: next ticket to hand out
+// lower halfword: ticket currently being served
+#define SPIN_LOCK_TICKET(l) ((l) >> 16)
+#define SPIN_LOCK_OWNER(l) ((l) & 0xffff)
+
 static inline void arch_spin_lock(spin_lock_t *lock) {
-    // TODO, actually spin
-    // it only works, because its set to single-core mode, and irq's are turned off before getting the lock
-    *lock = 1;
+    unsigned int old, tmp;
+    __asm__ volatile(
+        "1: lwarx %0, 0, %2\n"
+        "   addis %1, %0, 1\n"
+        "   stwcx. %1, 0, %2\n"
+        "   bne- 1b\n"
+        : "=&b"(old), "=&r"(tmp) : "r"(lock) : "cr0", "memory");
+
+    unsigned int ticket = SPIN_LOCK_TICKET(old);
+    if (SPIN_LOCK_OWNER(old) != ticket) {
+        // give the issue slots to the other hw thread on this core while we wait
+        ppc64_smt_priority_low();
+        while (SPIN_LOCK_OWNER(*(volatile spin_lock_t *)lock) != ticket)
+            ;
+        ppc64_smt_priority_medium();
+    }
+    // the branch on the loaded value plus isync keeps the critical section after the acquire
+    __asm__ volatile("isync" ::: "memory");
 }
 
+// returns 0 if the lock was acquired
 static inline int arch_spin_trylock(spin_lock_t *lock) {
-    return 0;
+    unsigned int old, ret;
+    __asm__ volatile(
+        "1: lwarx %0, 0, %2\n"
+        "   rotlwi %1, %0, 16\n"
+        "   cmpw %1, %0\n"  // halves only match when nobody holds or waits
+        "   bne- 2f\n"
+        "   addis %1, %0, 1\n"
+        "   stwcx. %1, 0, %2\n"
+        "   bne- 1b\n"
+        "   isync\n"
+        "   li %1, 0\n"
+        "   b 3f\n"
+        "2: li %1, 1\n"
+        "3:\n"
+        : "=&b"(old), "=&r"(ret) : "r"(lock) : "cr0", "memory");
+    return ret;
 }
 
 static inline void arch_spin_unlock(spin_lock_t *lock) {
-    *lock = 0;
+    // only the holder ever writes the owner halfword, so no reservation is needed
+    // big endian, the lower halfword is the second one in memory
+    volatile uint16_t *owner = (volatile uint16_t *)lock + 1;
+    __asm__ volatile("lwsync" ::: "memory");
+    *owner = *owner + 1;
 }
 
 static inline void arch_spin_lock_init(spin_lock_t *lock) {
@@ -28,7 +72,8 @@ static inline void arch_spin_lock_init(spin_lock_t *lock) {
 }
 
 static inline bool arch_spin_lock_held(spin_lock_t *lock) {
-    return *lock != 0;
+    spin_lock_t l = *(volatile spin_lock_t *)lock;
+    return SPIN_LOCK_TICKET(l) != SPIN_LOCK_OWNER(l);
 }
 
 /* default arm flag is to just disable plain irqs */
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// tlbie/tlbiel RB values, the low bit stands in for the instruction's L field
+#define PPC64_TLB_RB_LARGE 1ULL
+
+#define PPC64_TLB_GATHER_MAX 32
+
+// invalidations collected while the page tables are locked and issued in one go after
+// cpu_mask is every cpu that may hold one of the translations
+struct ppc64_tlb_gather {
+  uint cpu_mask;
+  uint count;
+  uint64_t rb[PPC64_TLB_GATHER_MAX];
+};
+
+static inline void ppc64_tlb_gather_init(struct ppc64_tlb_gather *g, uint cpu_mask) {
+  g->cpu_mask = cpu_mask;
+  g->count = 0;
+}
+
+static inline bool ppc64_tlb_gather_full(const struct ppc64_tlb_gather *g) {
+  return g->count == PPC64_TLB_GATHER_MAX;
+}
+
+// the caller flushes once full, never with a spinlock held another cpu may spin on
+static inline void ppc64_tlb_gather_add(struct ppc64_tlb_gather *g, uint64_t rb) {
+  g->rb[g->count++] = rb;
+}
+
+void ppc64_tlb_gather_flush(struct ppc64_tlb_gather *g);
+
+// one translation on every cpu, safe under any lock
+void ppc64_tlb_invalidate(uint64_t rb);
+
+// PPC64_IPI_TLB, and polled by cpus waiting to start a shootdown of their own
+void ppc64_tlb_shootdown_irq(void);
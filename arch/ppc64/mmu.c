@@ -1,33 +1,1385 @@
+#include <arch/atomic.h>
+#include <arch/cpu_regs.h>
+#include <arch/hypercalls.h>
+#include <arch/iframe.h>
 #include <arch/mmu.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <arch/tlb.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/init.h>
+#include <lk/trace.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
+
+#define LOCAL_TRACE 0
+
+// hashed page table, 256MB segments
+// every aspace has a software page table holding its 4K mappings, the HPT only caches them
+// when both groups for a page are full one unbolted entry is evicted, the DSI/ISI that
+// follows faults it back in from the software table
+// RAM itself is a bolted identity linear map of the largest page size the cpu has, in
+// segments of their own since the base page size is per segment
+// under an LPAR the table belongs to the hypervisor and every access is an hcall instead
+
+#define SEGMENT_SHIFT 28
+#define HPTES_PER_GROUP 8
+
+// dword 0
+#define HPTE_V_VALID      (1ULL << 0)
+#define HPTE_V_SECONDARY  (1ULL << 1)
+#define HPTE_V_LARGE      (1ULL << 2)
+#define HPTE_V_BOLTED     (1ULL << 4) // software, never evicted
+#define HPTE_V_AVPN_SHIFT 7
+
+// dword 1
+#define HPTE_R_R  (1ULL << 8)
+#define HPTE_R_C  (1ULL << 7)
+#define HPTE_R_W  (1ULL << 6)
+#define HPTE_R_I  (1ULL << 5)
+#define HPTE_R_M  (1ULL << 4)
+#define HPTE_R_G  (1ULL << 3)
+#define HPTE_R_N  (1ULL << 2)
+#define HPTE_R_PP (3ULL << 0)
+
+#define HPTE_R_RPN_SHIFT 12
+
+// SLB
+#define SLB_ESID_V     (1ULL << 27)
+#define SLB_VSID_SHIFT 12
+#define SLB_VSID_KS    (1ULL << 11)
+#define SLB_VSID_KP    (1ULL << 10)
+#define SLB_VSID_L     (1ULL << 8)
+#define SLB_VSID_LP_01 (1ULL << 4)
+
+// kernel segments run with Ks=0 Kp=1, user segments with Ks=1 Kp=1
+#define HPTE_R_PP_KERNEL_RW 0 // key 0 rw, key 1 none
+#define HPTE_R_PP_USER_RW   2 // rw for both keys
+#define HPTE_R_PP_RO        3 // ro for both keys
+
+// DSISR on a 0x300, the ISI reports the same conditions in SRR1
+#define DSISR_NOHPTE  (1ULL << 30)
+#define DSISR_PROTECT (1ULL << 27)
+#define DSISR_STORE   (1ULL << 25)
+
+// proto-vsid = context << 20 | esid over a 48 bit address space, scrambled so neighbouring
+// segments and contexts land in unrelated groups
+#define ESID_BITS 20
+#define VSID_BITS 36
+#define VSID_MULTIPLIER 12538073ULL // prime
+#define VSID_MODULUS ((1ULL << VSID_BITS) - 1)
+
+// every aspace but the kernel's owns a context for its life, so translations of different
+// aspaces sit side by side in the HPT and TLB and a switch only touches the SLB
+// the last context would scramble its last segment onto vsid 0, never handed out
+#define CONTEXT_BITS (VSID_BITS - ESID_BITS)
+#define CONTEXT_COUNT ((1U << CONTEXT_BITS) - 1)
+
+struct hpte {
+  uint64_t v;
+  uint64_t r;
+};
+
+// base page sizes, L||LP goes in the SLB and the matching LP encoding in the HPTE's RPN
+struct mmu_psize {
+  uint shift;
+  uint64_t slb;
+  uint64_t penc; // already shifted into the RPN field
+};
+
+static const struct mmu_psize psize_4k = { 12, 0, 0 };
+static const struct mmu_psize psize_64k = { 16, SLB_VSID_L | SLB_VSID_LP_01, 1ULL << HPTE_R_RPN_SHIFT };
+static const struct mmu_psize psize_16m = { 24, SLB_VSID_L, 0 };
+
+// identity map of RAM in [0, linear_ram), the segments up to linear_end hold nothing else
+static const struct mmu_psize *linear_psize = &psize_4k;
+static vaddr_t linear_ram;
+static vaddr_t linear_end;
+
+static struct hpte *hpt;     // NULL under an LPAR
+static bool hpt_lpar;
+static uint64_t *hpt_rmap;  // vpn per slot, the AVPN drops the low 11 bits that came from the hash
+static uint64_t hpt_mask;   // groups - 1
+static uint hpt_shift;      // log2 of the size in bytes
+static uint hpt_victim;     // round robin eviction cursor
+static spin_lock_t hpt_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static struct {
+  uint64_t inserts;
+  uint64_t secondary;
+  uint64_t evictions;
+  uint64_t faults;
+  uint64_t hcalls;
+} hpt_stats;
+
+// software page tables, 4 levels of 512 entries over a 48 bit address space
+// tables are only written under the vmm aspace lock, leaves only under hpt_lock
+#define PT_SHIFT 9
+#define PT_ENTRIES (1 << PT_SHIFT)
+#define PT_LEVELS 4
+
+#define PTE_VALID       (1ULL << 0)
+#define PTE_HASHED      (1ULL << 1) // an HPTE was inserted, slot hint below, checked before use
+#define PTE_SLOT_SHIFT  2           // secondary << 3 | index in the group
+#define PTE_SLOT_MASK   (0xfULL << PTE_SLOT_SHIFT)
+#define PTE_FLAGS_SHIFT 6           // ARCH_MMU_FLAG_*, the low 6 bits
+#define PTE_FLAGS_MASK  (0x3fULL << PTE_FLAGS_SHIFT)
+#define PTE_PA_MASK     (~0xfffULL)
+
+static uint64_t kernel_pt_root[PT_ENTRIES] __ALIGNED(PAGE_SIZE);
+static arch_aspace_t *kernel_aspace;
+
+static uint64_t context_map[CONTEXT_COUNT / 64 + 1] = { 1 }; // context 0 is the kernel's
+static uint context_next = 1;
+static uint context_used = 1;
+static spin_lock_t context_lock = SPIN_LOCK_INITIAL_VALUE;
+
+// round robin from the last one handed out, a freed context is the last to come back
+static int context_alloc(void) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&context_lock, state);
+  int context = -1;
+  for (uint i = 0; i < CONTEXT_COUNT; i++) {
+    uint c = (context_next + i) % CONTEXT_COUNT;
+    if (!(context_map[c / 64] & (1ULL << (c % 64)))) {
+      context_map[c / 64] |= 1ULL << (c % 64);
+      context_next = c + 1;
+      context_used++;
+      context = c;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&context_lock, state);
+  return context;
+}
+
+static void context_free(uint context) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&context_lock, state);
+  context_map[context / 64] &= ~(1ULL << (context % 64));
+  context_used--;
+  spin_unlock_irqrestore(&context_lock, state);
+}
+
+uint64_t ppc64_mmu_vsid(const arch_aspace_t *aspace, vaddr_t va) {
+  uint64_t proto = (va >> SEGMENT_SHIFT) & ((1ULL << ESID_BITS) - 1);
+  if (aspace) proto |= (uint64_t)aspace->context << ESID_BITS;
+  return (proto * VSID_MULTIPLIER) % VSID_MODULUS;
+}
+
+static inline uint64_t mmu_vpn(uint64_t vsid, vaddr_t va) {
+  return (vsid << (SEGMENT_SHIFT - PAGE_SIZE_SHIFT)) | ((va & ((1ULL << SEGMENT_SHIFT) - 1)) >> PAGE_SIZE_SHIFT);
+}
+
+// primary hash, the secondary is its complement
+// vpns are always in 4K units, the page index within the segment is in the page's own size
+static inline uint64_t hpt_hash(uint64_t vpn, uint shift) {
+  uint64_t vsid = vpn >> (SEGMENT_SHIFT - PAGE_SIZE_SHIFT);
+  return (vsid & 0x7fffffffffULL) ^ ((vpn & 0xffff) >> (shift - PAGE_SIZE_SHIFT));
+}
+
+static inline uint64_t hpt_group(uint64_t vpn, uint shift, bool secondary) {
+  uint64_t hash = hpt_hash(vpn, shift);
+  return ((secondary ? ~hash : hash) & hpt_mask) * HPTES_PER_GROUP;
+}
+
+// AVPN is VA bits 0:56, pages over 8MB drop the low bits that their offset covers
+static inline uint64_t hpte_encode_v(uint64_t vpn, uint shift) {
+  uint64_t avpn = vpn >> 11;
+  if (shift > 23) avpn &= ~((1ULL << (shift - 23)) - 1);
+  return (avpn << HPTE_V_AVPN_SHIFT) | (shift > PAGE_SIZE_SHIFT ? HPTE_V_LARGE : 0);
+}
+
+static inline uint hpte_shift(const struct hpte *e) {
+  if (!(e->v & HPTE_V_LARGE)) return PAGE_SIZE_SHIFT;
+  return (e->r & psize_64k.penc) ? psize_64k.shift : psize_16m.shift;
+}
+
+static uint64_t hpte_encode_r(uint64_t pte) {
+  uint flags = (pte & PTE_FLAGS_MASK) >> PTE_FLAGS_SHIFT;
+  // preset R and C, nothing here reads them and it saves the hardware a store per first touch
+  uint64_t r = (pte & PTE_PA_MASK) | HPTE_R_R | HPTE_R_C;
+
+  switch (flags & ARCH_MMU_FLAG_CACHE_MASK) {
+    case ARCH_MMU_FLAG_CACHED:
+      r |= HPTE_R_M;
+      break;
+    case ARCH_MMU_FLAG_UNCACHED:
+      r |= HPTE_R_I;
+      break;
+    default:
+      r |= HPTE_R_I | HPTE_R_G;
+      break;
+  }
+  if (flags & ARCH_MMU_FLAG_PERM_NO_EXECUTE) r |= HPTE_R_N;
+
+  if (flags & ARCH_MMU_FLAG_PERM_RO) {
+    r |= HPTE_R_PP_RO;
+  } else if (flags & ARCH_MMU_FLAG_PERM_USER) {
+    r |= HPTE_R_PP_USER_RW;
+  } else {
+    r |= HPTE_R_PP_KERNEL_RW;
+  }
+  return r;
+}
+
+static uint64_t tlb_rb(uint64_t vpn, uint shift) {
+  uint64_t rb = (vpn << PAGE_SIZE_SHIFT) & ~(0xffffULL << 48);
+  if (shift == PAGE_SIZE_SHIFT) return rb;
+  // large page form, LP in the low RPN bits and L in bit 63 of RB
+  rb &= ~((1ULL << shift) - 1);
+  return rb | (shift == psize_64k.shift ? psize_64k.penc : psize_16m.penc) | PPC64_TLB_RB_LARGE;
+}
+
+static inline bool hpte_matches(const struct hpte *e, uint64_t vpn, uint shift, bool secondary) {
+  uint64_t want = hpte_encode_v(vpn, shift) | HPTE_V_VALID | (secondary ? HPTE_V_SECONDARY : 0);
+  return (e->v & ~HPTE_V_BOLTED) == want;
+}
+
+// hpt_lock held, the TLB entry goes into g or, without one, is broadcast right away
+static void hpt_invalidate_slot(uint64_t slot, struct ppc64_tlb_gather *g) {
+  uint64_t rb = tlb_rb(hpt_rmap[slot], hpte_shift(&hpt[slot]));
+  hpt[slot].v = 0;
+  if (g) {
+    ppc64_tlb_gather_add(g, rb);
+  } else {
+    ppc64_tlb_invalidate(rb);
+  }
+}
+
+static int64_t lpar_find(uint64_t vpn, uint shift);
+static uint64_t lpar_insert(uint64_t vpn, uint shift, uint64_t r, bool bolted);
+static void lpar_remove(uint64_t slot, uint64_t vpn);
+static bool lpar_protect(uint64_t slot, uint64_t vpn, uint64_t r);
+
+static inline uint64_t pte_slot(uint64_t pte, uint64_t vpn) {
+  uint64_t index = (pte & PTE_SLOT_MASK) >> PTE_SLOT_SHIFT;
+  return hpt_group(vpn, PAGE_SIZE_SHIFT, index & 8) + (index & 7);
+}
+
+// hpt_lock held, returns the slot
+static int64_t hpt_find(uint64_t vpn, uint shift) {
+  if (hpt_lpar) return lpar_find(vpn, shift);
+
+  for (int secondary = 0; secondary < 2; secondary++) {
+    uint64_t group = hpt_group(vpn, shift, secondary);
+    for (uint i = 0; i < HPTES_PER_GROUP; i++) {
+      if (hpte_matches(&hpt[group + i], vpn, shift, secondary)) return group + i;
+    }
+  }
+  return -1;
+}
+
+// hpt_lock held, returns the slot hint for the software pte
+static uint64_t hpt_insert(uint64_t vpn, uint shift, uint64_t r, bool bolted) {
+  if (hpt_lpar) return lpar_insert(vpn, shift, r, bolted);
+
+  uint64_t v = hpte_encode_v(vpn, shift) | HPTE_V_VALID | (bolted ? HPTE_V_BOLTED : 0);
+  int64_t slot = -1;
+  bool secondary = false;
+
+  for (int s = 0; s < 2 && slot < 0; s++) {
+    uint64_t group = hpt_group(vpn, shift, s);
+    for (uint i = 0; i < HPTES_PER_GROUP; i++) {
+      if (!(hpt[group + i].v & HPTE_V_VALID)) {
+        slot = group + i;
+        secondary = s;
+        break;
+      }
+    }
+  }
+
+  if (slot < 0) {
+    // both groups full, evict round robin from the primary group, bolted entries stay
+    uint64_t group = hpt_group(vpn, shift, false);
+    for (uint i = 0; i < HPTES_PER_GROUP; i++) {
+      uint64_t candidate = group + ((hpt_victim + i) % HPTES_PER_GROUP);
+      if (!(hpt[candidate].v & HPTE_V_BOLTED)) {
+        slot = candidate;
+        break;
+      }
+    }
+    hpt_victim++;
+    if (slot < 0) panic("hpt: group 0x%llx is all bolted\n", group / HPTES_PER_GROUP);
+    // could belong to any aspace, so every cpu
+    hpt_invalidate_slot(slot, NULL);
+    hpt_stats.evictions++;
+  }
+
+  if (secondary) {
+    v |= HPTE_V_SECONDARY;
+    hpt_stats.secondary++;
+  }
+  hpt_stats.inserts++;
+
+  // the valid bit goes in last, the hardware may walk the group at any time
+  hpt_rmap[slot] = vpn;
+  hpt[slot].r = r;
+  __asm__ volatile("eieio" ::: "memory");
+  hpt[slot].v = v;
+  __asm__ volatile("ptesync" ::: "memory");
+
+  uint64_t index = (slot % HPTES_PER_GROUP) | (secondary ? 8 : 0);
+  return PTE_HASHED | (index << PTE_SLOT_SHIFT);
+}
+
+// hpt_lock held, drop whatever HPTE the software pte points at
+static void hpt_remove(uint64_t pte, uint64_t vpn, struct ppc64_tlb_gather *g) {
+  if (!(pte & PTE_HASHED)) return;
+
+  uint64_t slot = pte_slot(pte, vpn);
+  if (hpt_lpar) {
+    lpar_remove(slot, vpn);
+    return;
+  }
+  if (!hpt) return;
+  // the hint goes stale when the entry was evicted, and the slot may hold someone else by now
+  bool secondary = (pte & PTE_SLOT_MASK) >> PTE_SLOT_SHIFT & 8;
+  if (hpte_matches(&hpt[slot], vpn, PAGE_SIZE_SHIFT, secondary)) hpt_invalidate_slot(slot, g);
+}
+
+// hpt_lock held, new pp/N bits for the HPTE the software pte points at, false if it is gone
+static bool hpt_protect(uint64_t pte, uint64_t vpn, uint64_t r, struct ppc64_tlb_gather *g) {
+  if (!(pte & PTE_HASHED)) return false;
+
+  uint64_t slot = pte_slot(pte, vpn);
+  if (hpt_lpar) return lpar_protect(slot, vpn, r);
+  if (!hpt) return false;
+
+  bool secondary = (pte & PTE_SLOT_MASK) >> PTE_SLOT_SHIFT & 8;
+  if (!hpte_matches(&hpt[slot], vpn, PAGE_SIZE_SHIFT, secondary)) return false;
+  hpt[slot].r = (hpt[slot].r & ~(HPTE_R_PP | HPTE_R_N)) | (r & (HPTE_R_PP | HPTE_R_N));
+  ppc64_tlb_gather_add(g, tlb_rb(vpn, PAGE_SIZE_SHIFT));
+  return true;
+}
+
+// pseries, the hypervisor owns the table and does the tlbie itself
+// nothing is mirrored locally, lookups read the groups back 4 entries per H_READ
+// removals queue up under hpt_lock and go 4 to an H_BULK_REMOVE, always before the lock is
+// dropped and before any H_ENTER that might want the slot back
+static uint64_t lpar_bulk[2 * H_BULK_REMOVE_MAX];
+static uint lpar_bulk_count;
+
+static inline uint64_t lpar_avpn(uint64_t vpn, uint shift) {
+  return hpte_encode_v(vpn, shift) & ~0x7fULL;
+}
+
+static void lpar_bulk_flush(void) {
+  if (!lpar_bulk_count) return;
+  if (lpar_bulk_count < H_BULK_REMOVE_MAX) lpar_bulk[2 * lpar_bulk_count] = H_BULK_REMOVE_END;
+  // stale slot hints come back per entry as not found, the call itself still succeeds
+  uint64_t rc = h_bulk_remove(lpar_bulk);
+  if (rc != H_SUCCESS) panic("hpt: H_BULK_REMOVE failed %lld\n", (long long)rc);
+  hpt_stats.hcalls++;
+  lpar_bulk_count = 0;
+}
+
+static void lpar_remove(uint64_t slot, uint64_t vpn) {
+  lpar_bulk[2 * lpar_bulk_count] = H_BULK_REMOVE_REQUEST | H_BULK_REMOVE_AVPN | slot;
+  lpar_bulk[2 * lpar_bulk_count + 1] = lpar_avpn(vpn, PAGE_SIZE_SHIFT);
+  if (++lpar_bulk_count == H_BULK_REMOVE_MAX) lpar_bulk_flush();
+}
+
+static bool lpar_protect(uint64_t slot, uint64_t vpn, uint64_t r) {
+  lpar_bulk_flush();
+  uint64_t rc = h_protect(H_AVPN | (r & (HPTE_R_PP | HPTE_R_N)), slot, lpar_avpn(vpn, PAGE_SIZE_SHIFT));
+  hpt_stats.hcalls++;
+  return rc == H_SUCCESS;
+}
+
+static void lpar_read_group(uint64_t group, struct hpte e[HPTES_PER_GROUP]) {
+  for (uint i = 0; i < HPTES_PER_GROUP; i += 4) {
+    uint64_t rc = h_read4(group + i, (uint64_t *)&e[i]);
+    if (rc != H_SUCCESS) panic("hpt: H_READ of 0x%llx failed %lld\n", group + i, (long long)rc);
+    hpt_stats.hcalls++;
+  }
+}
+
+static int64_t lpar_find(uint64_t vpn, uint shift) {
+  lpar_bulk_flush();
+  for (int secondary = 0; secondary < 2; secondary++) {
+    uint64_t group = hpt_group(vpn, shift, secondary);
+    struct hpte e[HPTES_PER_GROUP];
+    lpar_read_group(group, e);
+    for (uint i = 0; i < HPTES_PER_GROUP; i++) {
+      if (hpte_matches(&e[i], vpn, shift, secondary)) return group + i;
+    }
+  }
+  return -1;
+}
+
+// one H_ENTER per group tried, the hypervisor picks the free slot
+static uint64_t lpar_insert(uint64_t vpn, uint shift, uint64_t r, bool bolted) {
+  uint64_t v = hpte_encode_v(vpn, shift) | HPTE_V_VALID | (bolted ? HPTE_V_BOLTED : 0);
+  uint64_t slot, rc;
+  bool secondary = false;
+
+  lpar_bulk_flush();
+  hpt_stats.inserts++;
+  for (int s = 0; s < 2; s++) {
+    secondary = s;
+    rc = h_enter_slot(0, hpt_group(vpn, shift, s), v | (s ? HPTE_V_SECONDARY : 0), r, &slot);
+    hpt_stats.hcalls++;
+    if (rc != H_PTEG_FULL) break;
+  }
+
+  if (rc == H_PTEG_FULL) {
+    // both groups full, evict round robin from the primary group, bolted entries stay
+    uint64_t group = hpt_group(vpn, shift, false);
+    struct hpte e[HPTES_PER_GROUP];
+    lpar_read_group(group, e);
+    int victim = -1;
+    for (uint i = 0; i < HPTES_PER_GROUP && victim < 0; i++) {
+      uint candidate = (hpt_victim + i) % HPTES_PER_GROUP;
+      if (!(e[candidate].v & HPTE_V_BOLTED)) victim = candidate;
+    }
+    hpt_victim++;
+    if (victim < 0) panic("hpt: group 0x%llx is all bolted\n", group / HPTES_PER_GROUP);
+
+    secondary = false;
+    slot = group + victim;
+    h_remove(0, slot, 0);
+    rc = h_enter_slot(H_EXACT, slot, v, r, &slot);
+    hpt_stats.hcalls += 2;
+    hpt_stats.evictions++;
+  }
+  if (rc != H_SUCCESS) panic("hpt: H_ENTER failed %lld\n", (long long)rc);
+  if (secondary) hpt_stats.secondary++;
+
+  uint64_t index = (slot % HPTES_PER_GROUP) | (secondary ? 8 : 0);
+  return PTE_HASHED | (index << PTE_SLOT_SHIFT);
+}
+
+static inline bool hpt_present(void) {
+  return hpt || hpt_lpar;
+}
+
+// every hpt_lock section ends here, no hypervisor removal may outlive the lock
+static inline void hpt_unlock(spin_lock_saved_state_t state) {
+  if (hpt_lpar) lpar_bulk_flush();
+  spin_unlock_irqrestore(&hpt_lock, state);
+}
+
+static inline uint pt_index(vaddr_t va, uint level) {
+  return (va >> (PAGE_SIZE_SHIFT + PT_SHIFT * (PT_LEVELS - 1 - level))) & (PT_ENTRIES - 1);
+}
+
+// tables come zeroed from the pool where there is a pmm
+static uint64_t *pt_alloc(void) {
+#if WITH_KERNEL_VM
+  vm_page_t *p = ppc64_pmm_alloc_page(PPC64_PMM_ALLOC_FLAG_ZEROED);
+  return p ? paddr_to_kvaddr(vm_page_to_paddr(p)) : NULL;
+#else
+  uint64_t *table = memalign(PAGE_SIZE, PAGE_SIZE);
+  if (table) memset(table, 0, PAGE_SIZE);
+  return table;
+#endif
+}
+
+static void pt_release(uint64_t *table) {
+#if WITH_KERNEL_VM
+  pmm_free_page(paddr_to_vm_page(vaddr_to_paddr(table)));
+#else
+  free(table);
+#endif
+}
+
+// returns the leaf entry for va, allocating the tables on the way when asked to
+static uint64_t *pt_walk(arch_aspace_t *aspace, vaddr_t va, bool alloc) {
+  uint64_t *table = aspace->pt_root;
+  for (uint level = 0; level < PT_LEVELS - 1; level++) {
+    uint64_t *e = &table[pt_index(va, level)];
+    if (!(*e & PTE_VALID)) {
+      if (!alloc) return NULL;
+      uint64_t *next = pt_alloc();
+      if (!next) return NULL;
+      // publish the zeroed table before the pointer, the fault path walks without locks
+      __asm__ volatile("lwsync" ::: "memory");
+      *e = (uint64_t)next | PTE_VALID;
+    }
+    table = (uint64_t *)(*e & PTE_PA_MASK);
+  }
+  return &table[pt_index(va, PT_LEVELS - 1)];
+}
+
+static void pt_free(uint64_t *table, uint level) {
+  if (level < PT_LEVELS - 1) {
+    for (uint i = 0; i < PT_ENTRIES; i++) {
+      if (table[i] & PTE_VALID) pt_free((uint64_t *)(table[i] & PTE_PA_MASK), level + 1);
+    }
+  }
+  if (table != kernel_pt_root) pt_release(table);
+}
+
+static inline bool aspace_contains(const arch_aspace_t *aspace, vaddr_t va) {
+  return va >= aspace->base && va - aspace->base < aspace->size;
+}
 
 status_t arch_mmu_init_aspace(arch_aspace_t *aspace, vaddr_t base, size_t size, uint flags) {
-  printf("arch_mmu_init_aspace(%p, 0x%x, 0x%x, 0x%x)\n", aspace, base, size, flags);
-  return 0;
+  LTRACEF("aspace %p, base 0x%lx, size 0x%zx, flags 0x%x\n", aspace, base, size, flags);
+
+  aspace->base = base;
+  aspace->size = size;
+  aspace->flags = flags;
+  aspace->context = 0;
+  // the kernel aspace is live everywhere, the rest pick cpus up as they are switched in
+  aspace->cpu_mask = (flags & ARCH_ASPACE_FLAG_KERNEL) ? ~0 : 0;
+  memset(aspace->slb_cache, 0, sizeof(aspace->slb_cache));
+  aspace->slb_cache_next = 0;
+
+  if (flags & ARCH_ASPACE_FLAG_KERNEL) {
+    // runs before the heap exists
+    aspace->pt_root = kernel_pt_root;
+    kernel_aspace = aspace;
+  } else {
+    int context = context_alloc();
+    if (context < 0) return ERR_NO_RESOURCES;
+    aspace->pt_root = pt_alloc();
+    if (!aspace->pt_root) {
+      context_free(context);
+      return ERR_NO_MEMORY;
+    }
+    aspace->context = context;
+  }
+  return NO_ERROR;
 }
 
 status_t arch_mmu_destroy_aspace(arch_aspace_t *aspace) {
-  printf("arch_mmu_destroy_aspace(%p)\n", aspace);
-  return 0;
+  LTRACEF("aspace %p\n", aspace);
+
+  // the vmm unmapped every region already, only the tables are left and no HPTE or TLB
+  // entry still carries the context's vsids, so it can be handed out again
+  pt_free(aspace->pt_root, 0);
+  aspace->pt_root = NULL;
+  if (kernel_aspace == aspace) kernel_aspace = NULL;
+  if (aspace->context) context_free(aspace->context);
+  aspace->context = 0;
+  return NO_ERROR;
 }
 
 int arch_mmu_map(arch_aspace_t *aspace, vaddr_t vaddr, paddr_t paddr, uint count, uint flags) {
-  printf("arch_mmu_map(%p, 0x%x, 0x%x, %d, 0x%x)\n", aspace, vaddr, paddr, count, flags);
-  return 0;
+  LTRACEF("aspace %p, vaddr 0x%lx, paddr 0x%lx, count %u, flags 0x%x\n", aspace, vaddr, paddr, count, flags);
+
+  if ((vaddr | paddr) & (PAGE_SIZE - 1)) return ERR_INVALID_ARGS;
+
+  // only remapping an existing page leaves anything to invalidate
+  struct ppc64_tlb_gather g;
+  ppc64_tlb_gather_init(&g, aspace->cpu_mask);
+  int ret = 0;
+
+  for (uint i = 0; i < count; i++, vaddr += PAGE_SIZE, paddr += PAGE_SIZE) {
+    if (!aspace_contains(aspace, vaddr)) {
+      ret = ERR_OUT_OF_RANGE;
+      break;
+    }
+    // the linear map segments only take large pages
+    if (aspace == kernel_aspace && vaddr < linear_end) {
+      ret = ERR_INVALID_ARGS;
+      break;
+    }
+
+    uint64_t *e = pt_walk(aspace, vaddr, true);
+    if (!e) {
+      ret = ERR_NO_MEMORY;
+      break;
+    }
+
+    uint64_t vpn = mmu_vpn(ppc64_mmu_vsid(aspace, vaddr), vaddr);
+    uint64_t pte = paddr | ((uint64_t)(flags & 0x3f) << PTE_FLAGS_SHIFT) | PTE_VALID;
+
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&hpt_lock, state);
+    uint64_t old = *e;
+    uint64_t keep = PTE_PA_MASK | ((uint64_t)ARCH_MMU_FLAG_CACHE_MASK << PTE_FLAGS_SHIFT) | PTE_VALID;
+    if ((old & keep) == (pte & keep) && hpt_protect(old, vpn, hpte_encode_r(pte), &g)) {
+      // same page and cache mode, only the permissions change, the HPTE stays where it is
+      pte |= old & (PTE_HASHED | PTE_SLOT_MASK);
+    } else {
+      if (old & PTE_VALID) hpt_remove(old, vpn, &g);
+      // prefault, the caller is about to touch it
+      if (hpt_present()) pte |= hpt_insert(vpn, PAGE_SIZE_SHIFT, hpte_encode_r(pte), false);
+    }
+    *e = pte;
+    hpt_unlock(state);
+
+    if (ppc64_tlb_gather_full(&g)) ppc64_tlb_gather_flush(&g);
+  }
+  ppc64_tlb_gather_flush(&g);
+  return ret;
 }
 
+#define UNMAP_LOCK_PAGES 64
+
 int arch_mmu_unmap(arch_aspace_t *aspace, vaddr_t vaddr, uint count) {
-  printf("arch_mmu_unmap(%p, 0x%x, %d)\n", aspace, vaddr, count);
+  LTRACEF("aspace %p, vaddr 0x%lx, count %u\n", aspace, vaddr, count);
+
+  if (vaddr & (PAGE_SIZE - 1)) return ERR_INVALID_ARGS;
+
+  // one ptesync/tlbsync round per batch rather than per page, and only on the cpus that
+  // have run the aspace
+  struct ppc64_tlb_gather g;
+  ppc64_tlb_gather_init(&g, aspace->cpu_mask);
+
+  // the lock covers a batch so hypervisor removals fill up their H_BULK_REMOVE too, but it is
+  // dropped every UNMAP_LOCK_PAGES pages walked, so a big mostly empty range doesn't keep
+  // interrupts off. pages without a leaf table are skipped a table at a time
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&hpt_lock, state);
+  uint walked = 0;
+  for (uint i = 0; i < count;) {
+    uint64_t *e = pt_walk(aspace, vaddr, false);
+    uint step = 1;
+    if (!e) {
+      step = PT_ENTRIES - pt_index(vaddr, PT_LEVELS - 1);
+      if (step > count - i) step = count - i;
+    } else if (*e & PTE_VALID) {
+      hpt_remove(*e, mmu_vpn(ppc64_mmu_vsid(aspace, vaddr), vaddr), &g);
+      *e = 0;
+    }
+    i += step;
+    vaddr += (vaddr_t)step * PAGE_SIZE;
+
+    if (++walked == UNMAP_LOCK_PAGES || ppc64_tlb_gather_full(&g)) {
+      hpt_unlock(state);
+      if (ppc64_tlb_gather_full(&g)) ppc64_tlb_gather_flush(&g);
+      walked = 0;
+      spin_lock_irqsave(&hpt_lock, state);
+    }
+  }
+  hpt_unlock(state);
+  ppc64_tlb_gather_flush(&g);
   return 0;
 }
 
 status_t arch_mmu_query(arch_aspace_t *aspace, vaddr_t vaddr, paddr_t *paddr, uint *flags) {
-  printf("arch_mmu_query(%p, 0x%x, 0x%x, 0x%x)\n", aspace, vaddr, paddr, flags);
-  *paddr = vaddr;
-  *flags = 0;
-  return 0;
+  if (aspace == kernel_aspace && vaddr < linear_end) {
+    if (vaddr >= linear_ram) return ERR_NOT_FOUND;
+    if (paddr) *paddr = vaddr;
+    if (flags) *flags = ARCH_MMU_FLAG_CACHED;
+    return NO_ERROR;
+  }
+
+  uint64_t *e = pt_walk(aspace, vaddr, false);
+  uint64_t pte = e ? *e : 0;
+  if (!(pte & PTE_VALID)) return ERR_NOT_FOUND;
+
+  if (paddr) *paddr = (pte & PTE_PA_MASK) | (vaddr & (PAGE_SIZE - 1));
+  if (flags) *flags = (pte & PTE_FLAGS_MASK) >> PTE_FLAGS_SHIFT;
+  return NO_ERROR;
 }
 
+static void slb_switch(arch_aspace_t *aspace);
+
 void arch_mmu_context_switch(arch_aspace_t *aspace) {
-  printf("arch_mmu_context_switch(%p)\n", aspace);
+  LTRACEF("aspace %p\n", aspace);
+
+  slb_switch(aspace);
+}
+
+static arch_aspace_t *fault_aspace(vaddr_t va) {
+  if (kernel_aspace && aspace_contains(kernel_aspace, va)) return kernel_aspace;
+#if WITH_KERNEL_VM
+  vmm_aspace_t *aspace = get_current_thread()->aspace;
+  if (aspace && aspace_contains(&aspace->arch_aspace, va)) return &aspace->arch_aspace;
+#endif
+  return NULL;
+}
+
+static uint64_t linear_hpte_r(paddr_t pa) {
+  return pa | linear_psize->penc | HPTE_R_R | HPTE_R_C | HPTE_R_M | HPTE_R_PP_KERNEL_RW;
 }
+
+// only with 4K linear pages, everything but the kernel text comes in on demand
+static bool linear_fault(vaddr_t va) {
+  uint shift = linear_psize->shift;
+  va = ROUNDDOWN(va, 1ULL << shift);
+  uint64_t vpn = mmu_vpn(ppc64_mmu_vsid(kernel_aspace, va), va);
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&hpt_lock, state);
+  if (hpt_find(vpn, shift) < 0) hpt_insert(vpn, shift, linear_hpte_r(va), false);
+  hpt_stats.faults++;
+  hpt_unlock(state);
+  return true;
+}
+
+// lazily backed kernel memory, see ppc64_lazy_alloc()
+// reads of an untouched page map one shared zero page read only, the first store takes a
+// protection fault and swaps in a page of its own, so nothing is allocated for what is never
+// written. regions live in a window at the top of the kernel aspace reserved from the vmm
+// exceptions run in real mode on the interrupted stack, so stacks can never be lazy
+#define LAZY_REGIONS 16
+#define LAZY_RESERVE 64
+#define LAZY_BASE (KERNEL_ASPACE_BASE + KERNEL_ASPACE_SIZE - (1UL << SEGMENT_SHIFT))
+#define LAZY_SIZE (1UL << SEGMENT_SHIFT)
+
+static uint8_t lazy_zero_page[PAGE_SIZE] __ALIGNED(PAGE_SIZE);
+
+static struct {
+  uint64_t pages;
+  uint64_t zero_maps;
+} lazy_stats;
+
+// the kernel image is in the linear map, va == pa
+static inline bool pte_is_zero_page(uint64_t pte) {
+  return (pte & PTE_PA_MASK) == (uint64_t)lazy_zero_page;
+}
+
+// under hpt_lock, fresh is a zeroed page for a store or 0
+static bool lazy_fault(uint64_t *e, uint64_t vpn, uint flags, bool store, paddr_t *fresh,
+                       struct ppc64_tlb_gather *g) {
+  if (store && (flags & ARCH_MMU_FLAG_PERM_RO)) return false;
+
+  paddr_t pa;
+  if (store) {
+    // raced with a read fault that mapped the zero page, the retry comes back with a page
+    if (!*fresh) return true;
+    pa = *fresh;
+    *fresh = 0;
+    lazy_stats.pages++;
+  } else {
+    pa = (paddr_t)lazy_zero_page;
+    flags |= ARCH_MMU_FLAG_PERM_RO;
+    lazy_stats.zero_maps++;
+  }
+
+  // the zero page goes away everywhere before anyone stores to the new one
+  uint64_t old = *e;
+  if (old & PTE_VALID) hpt_remove(old, vpn, g);
+  uint64_t pte = pa | ((uint64_t)(flags & 0x3f) << PTE_FLAGS_SHIFT) | PTE_VALID;
+  *e = pte | hpt_insert(vpn, PAGE_SIZE_SHIFT, hpte_encode_r(pte), false);
+  hpt_stats.faults++;
+  return true;
+}
+
+#if WITH_KERNEL_VM
+struct lazy_region {
+  vaddr_t base; // 0 when free
+  size_t size;
+  uint flags;
+};
+
+static struct lazy_region lazy_regions[LAZY_REGIONS];
+static paddr_t lazy_reserve[LAZY_RESERVE];
+static uint lazy_reserve_count;
+static volatile int lazy_refill_wanted;
+static event_t lazy_refill_event = EVENT_INITIAL_VALUE(lazy_refill_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+static spin_lock_t lazy_lock = SPIN_LOCK_INITIAL_VALUE;   // the region list for lookups, the reserve
+static mutex_t lazy_mutex = MUTEX_INITIAL_VALUE(lazy_mutex); // serializes alloc and free
+
+static bool lazy_lookup(vaddr_t va, uint *flags) {
+  bool found = false;
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&lazy_lock, state);
+  for (uint i = 0; i < LAZY_REGIONS; i++) {
+    const struct lazy_region *r = &lazy_regions[i];
+    if (r->base && va >= r->base && va - r->base < r->size) {
+      *flags = r->flags;
+      found = true;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&lazy_lock, state);
+  return found;
+}
+
+static paddr_t lazy_page_alloc(void) {
+  vm_page_t *p = ppc64_pmm_alloc_page(PPC64_PMM_ALLOC_FLAG_ZEROED);
+  return p ? vm_page_to_paddr(p) : 0;
+}
+
+static void lazy_page_put(paddr_t pa) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&lazy_lock, state);
+  if (lazy_reserve_count < LAZY_RESERVE) {
+    lazy_reserve[lazy_reserve_count++] = pa;
+    pa = 0;
+  }
+  spin_unlock_irqrestore(&lazy_lock, state);
+  if (pa) pmm_free_page(paddr_to_vm_page(pa));
+}
+
+static void lazy_reserve_fill(void) {
+  while (lazy_reserve_count < LAZY_RESERVE) {
+    paddr_t pa = lazy_page_alloc();
+    if (!pa) break;
+    lazy_page_put(pa);
+  }
+}
+
+// the pmm takes a mutex and may block, so the reserve is refilled by a thread of its own at
+// the highest priority, nothing runnable can keep it off the cpu
+static int lazy_refill_thread(void *arg) {
+  for (;;) {
+    event_wait(&lazy_refill_event);
+    lazy_reserve_fill();
+  }
+  return 0;
+}
+
+// the fault handler runs in real mode and must not block, so it only ever takes from the
+// reserve. it may only wake the refill thread when the code it interrupted had EE on, with EE
+// off that code may hold thread_lock, so the flag waits for the next decrementer tick
+static paddr_t lazy_page(void) {
+  paddr_t pa = 0;
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&lazy_lock, state);
+  if (lazy_reserve_count) pa = lazy_reserve[--lazy_reserve_count];
+  if (lazy_reserve_count < LAZY_RESERVE / 2) lazy_refill_wanted = 1;
+  spin_unlock_irqrestore(&lazy_lock, state);
+  return pa;
+}
+
+// from the fast path decrementer or a fault on code with EE on, neither can be under a spinlock
+enum handler_return ppc64_lazy_irq(void) {
+  if (!lazy_refill_wanted || !atomic_swap(&lazy_refill_wanted, 0)) return INT_NO_RESCHEDULE;
+  event_signal(&lazy_refill_event, false);
+  return INT_RESCHEDULE;
+}
+
+static void lazy_init(uint level) {
+  if (vmm_reserve_space(vmm_get_kernel_aspace(), "lazy", LAZY_SIZE, LAZY_BASE) < 0) {
+    panic("hpt: lazy window 0x%lx is taken\n", LAZY_BASE);
+  }
+  lazy_reserve_fill();
+}
+
+LK_INIT_HOOK(ppc64_lazy, lazy_init, LK_INIT_LEVEL_VM + 1);
+
+static void lazy_thread_init(uint level) {
+  thread_t *t = thread_create("lazy refill", lazy_refill_thread, NULL, HIGHEST_PRIORITY, DEFAULT_STACK_SIZE);
+  if (!t) panic("hpt: no lazy refill thread\n");
+  thread_detach_and_resume(t);
+}
+
+LK_INIT_HOOK(ppc64_lazy_thread, lazy_thread_init, LK_INIT_LEVEL_THREADING);
+
+// NULL with translation off, the window's addresses would be whatever RAM sits there. the
+// region is only safe to touch from threads that run translated
+void *ppc64_lazy_alloc(size_t size, uint arch_mmu_flags) {
+  size = ROUNDUP(size, PAGE_SIZE);
+  if (!size || size > LAZY_SIZE || !(msr_read() & MSR_DR)) return NULL;
+
+  mutex_acquire(&lazy_mutex);
+
+  // first fit, start over past whichever region is in the way
+  struct lazy_region *slot = NULL;
+  vaddr_t base = LAZY_BASE;
+  bool moved;
+  do {
+    moved = false;
+    for (uint i = 0; i < LAZY_REGIONS; i++) {
+      const struct lazy_region *r = &lazy_regions[i];
+      if (!r->base) {
+        if (!slot) slot = &lazy_regions[i];
+      } else if (base < r->base + r->size && r->base < base + size) {
+        base = r->base + r->size;
+        moved = true;
+      }
+    }
+  } while (moved);
+  if (!slot || base + size > LAZY_BASE + LAZY_SIZE) {
+    mutex_release(&lazy_mutex);
+    return NULL;
+  }
+
+  // the fault path can't allocate tables, all the leaf tables come in now
+  for (vaddr_t va = ROUNDDOWN(base, PAGE_SIZE << PT_SHIFT); va < base + size; va += PAGE_SIZE << PT_SHIFT) {
+    if (!pt_walk(kernel_aspace, va, true)) {
+      mutex_release(&lazy_mutex);
+      return NULL;
+    }
+  }
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&lazy_lock, state);
+  slot->base = base;
+  slot->size = size;
+  slot->flags = arch_mmu_flags & 0x3f;
+  spin_unlock_irqrestore(&lazy_lock, state);
+  mutex_release(&lazy_mutex);
+
+  LTRACEF("0x%lx size 0x%zx\n", base, size);
+  return (void *)base;
+}
+
+void ppc64_lazy_free(void *ptr) {
+  vaddr_t base = (vaddr_t)ptr;
+
+  mutex_acquire(&lazy_mutex);
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&lazy_lock, state);
+  size_t size = 0;
+  for (uint i = 0; i < LAZY_REGIONS; i++) {
+    if (lazy_regions[i].base == base) {
+      size = lazy_regions[i].size;
+      lazy_regions[i].base = 0;
+      lazy_regions[i].size = 0;
+      break;
+    }
+  }
+  spin_unlock_irqrestore(&lazy_lock, state);
+  if (!size) panic("lazy free of unknown region %p\n", ptr);
+
+  // out of the region list, nothing faults pages back in; free them after the unmap
+  struct list_node pages = LIST_INITIAL_VALUE(pages);
+  for (vaddr_t va = base; va < base + size; va += PAGE_SIZE) {
+    paddr_t pa;
+    if (arch_mmu_query(kernel_aspace, va, &pa, NULL) == NO_ERROR && !pte_is_zero_page(pa)) {
+      list_add_tail(&pages, &paddr_to_vm_page(pa)->node);
+    }
+  }
+  arch_mmu_unmap(kernel_aspace, base, size / PAGE_SIZE);
+  mutex_release(&lazy_mutex);
+  pmm_free(&pages);
+}
+#else
+static inline bool lazy_lookup(vaddr_t va, uint *flags) {
+  return false;
+}
+
+static inline paddr_t lazy_page(void) {
+  return 0;
+}
+
+enum handler_return ppc64_lazy_irq(void) {
+  return INT_NO_RESCHEDULE;
+}
+
+// no vmm to take a window from, callers fall back to allocating up front
+void *ppc64_lazy_alloc(size_t size, uint arch_mmu_flags) {
+  return NULL;
+}
+
+void ppc64_lazy_free(void *ptr) {
+}
+
+static inline void lazy_page_put(paddr_t pa) {
+}
+#endif
+
+// 0x300/0x400 with no HPTE for the address, refill it from the software table or fill in a
+// lazy page. a store to the zero page is the one protection fault handled here, the rest
+// and unmapped addresses are left to the caller
+bool ppc64_mmu_fault(struct ppc64_iframe *frame) {
+  vaddr_t va;
+  bool nohpte, store = false;
+  if (frame->vector == 0x300) {
+    nohpte = frame->dsisr & DSISR_NOHPTE;
+    store = frame->dsisr & DSISR_STORE;
+    if (!nohpte && !(store && (frame->dsisr & DSISR_PROTECT))) return false;
+    va = frame->dar;
+  } else {
+    nohpte = frame->srr1 & DSISR_NOHPTE;
+    if (!nohpte) return false;
+    va = frame->srr0;
+  }
+
+  if (!hpt_present()) return false;
+  if (va < linear_end) return nohpte && va < linear_ram && linear_fault(va);
+
+  arch_aspace_t *aspace = fault_aspace(va);
+  if (!aspace) return false;
+
+  uint64_t *e = pt_walk(aspace, va, false);
+  if (!e) return false;
+
+  // the page comes off the reserve before hpt_lock
+  uint lazy_flags = 0;
+  bool lazy = aspace == kernel_aspace && lazy_lookup(va, &lazy_flags);
+  paddr_t fresh = 0;
+  if (lazy && store && (!(*e & PTE_VALID) || pte_is_zero_page(*e))) {
+    fresh = lazy_page();
+    // the reserve ran dry between two ticks, retrying would only spin until the refill thread
+    // gets the cpu, and code with interrupts off never gives it one
+    if (!fresh) {
+      dprintf(CRITICAL, "hpt: lazy reserve empty, store to 0x%lx\n", va);
+      return false;
+    }
+  }
+
+  uint64_t vpn = mmu_vpn(ppc64_mmu_vsid(aspace, va), va);
+  struct ppc64_tlb_gather g;
+  ppc64_tlb_gather_init(&g, aspace->cpu_mask);
+  bool handled = false;
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&hpt_lock, state);
+  uint64_t pte = *e;
+  if ((pte & PTE_VALID) && !(store && lazy && pte_is_zero_page(pte))) {
+    // another cpu may have refilled it meanwhile
+    if (nohpte && hpt_find(vpn, PAGE_SIZE_SHIFT) < 0) {
+      pte = (pte & ~(PTE_HASHED | PTE_SLOT_MASK)) | hpt_insert(vpn, PAGE_SIZE_SHIFT, hpte_encode_r(pte), false);
+      *e = pte;
+    }
+    if (nohpte) hpt_stats.faults++;
+    // or swapped the zero page for a writable one since we looked, or its flush hasn't reached
+    // our stale read only TLB entry yet. either way the store goes through on a retry
+    bool writable = !((pte >> PTE_FLAGS_SHIFT) & ARCH_MMU_FLAG_PERM_RO);
+    handled = nohpte || (store && writable);
+  } else if (lazy) {
+    handled = lazy_fault(e, vpn, lazy_flags, store, &fresh, &g);
+  }
+  hpt_unlock(state);
+  ppc64_tlb_gather_flush(&g);
+
+  // another cpu filled it first
+  if (fresh) lazy_page_put(fresh);
+  // the slow path can't switch threads, the refill thread runs at the next reschedule
+  if (lazy && (frame->srr1 & MSR_EE)) ppc64_lazy_irq();
+  return handled;
+}
+
+arch_aspace_t *ppc64_mmu_kernel_aspace(void) {
+  return kernel_aspace;
+}
+
+// SLB, the first slb_bolted slots hold the kernel text, boot stack and linear map segments
+// and are never replaced, the rest refill on 0x380/0x480 round robin
+// interrupts run in real mode, so the miss handler itself can never take a segment miss
+#define SLB_MAX 64
+#define SLB_BOLTED_MAX 4
+
+struct slb_cpu {
+  uint64_t esid[SLB_MAX];      // RB of every slot as written, 0 when empty
+  uint64_t user;               // slots holding a non kernel segment, bit per slot
+  uint next;                   // round robin cursor over the unbolted slots
+  const arch_aspace_t *aspace; // context the unbolted slots were filled for
+} __ALIGNED(CACHE_LINE);
+
+static struct slb_cpu slb_cpus[SMP_MAX_CPUS];
+static uint slb_size;
+static uint slb_bolted;
+static uint64_t slb_bolted_esid[SLB_BOLTED_MAX];
+
+static uint64_t slb_vsid_word(const arch_aspace_t *aspace, vaddr_t va) {
+  const struct mmu_psize *psize = (aspace == kernel_aspace && va < linear_end) ? linear_psize : &psize_4k;
+  uint64_t keys = (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) ? SLB_VSID_KP : SLB_VSID_KS | SLB_VSID_KP;
+  return (ppc64_mmu_vsid(aspace, va) << SLB_VSID_SHIFT) | keys | psize->slb;
+}
+
+static void slb_write(struct slb_cpu *c, uint slot, const arch_aspace_t *aspace, vaddr_t va) {
+  uint64_t esid = ROUNDDOWN(va, 1ULL << SEGMENT_SHIFT);
+  __asm__ volatile("slbmte %0, %1" :: "r"(slb_vsid_word(aspace, va)), "r"(esid | SLB_ESID_V | slot) : "memory");
+  c->esid[slot] = esid | SLB_ESID_V;
+  if (aspace == kernel_aspace) {
+    c->user &= ~(1ULL << slot);
+  } else {
+    c->user |= 1ULL << slot;
+  }
+}
+
+// interrupts off
+static void slb_insert(struct slb_cpu *c, const arch_aspace_t *aspace, vaddr_t va) {
+  uint slot = c->next;
+  if (++c->next >= slb_size) c->next = slb_bolted;
+  // the old entry goes with the overwrite, slbmte replaces the whole slot
+  slb_write(c, slot, aspace, va);
+}
+
+// interrupts off, kernel segments stay valid across every context
+static void slb_flush_user(struct slb_cpu *c) {
+  for (uint slot = slb_bolted; slot < slb_size; slot++) {
+    if (!(c->user & (1ULL << slot))) continue;
+    __asm__ volatile("slbie %0" :: "r"(c->esid[slot] & ~SLB_ESID_V) : "memory");
+    c->esid[slot] = 0;
+  }
+  c->user = 0;
+  __asm__ volatile("isync" ::: "memory");
+}
+
+// 0x380/0x480 from the fast path, interrupts off
+bool ppc64_mmu_slb_miss(struct ppc64_iframe *frame) {
+  // the fast entry doesnt save DAR, nothing since the miss has touched it
+  vaddr_t va = frame->vector == 0x380 ? dar_read() : frame->srr0;
+  arch_aspace_t *aspace = (va < linear_end && kernel_aspace) ? kernel_aspace : fault_aspace(va);
+  if (!aspace || !slb_size) return false;
+
+  slb_insert(PPC64_PACA_LD(slb), aspace, va);
+
+  // remembered per context and preloaded when it is switched back in, racy between cpus
+  // sharing the aspace but every slot is a single store of a valid esid
+  if (aspace != kernel_aspace) {
+    uint64_t esid = ROUNDDOWN(va, 1ULL << SEGMENT_SHIFT) | SLB_ESID_V;
+    uint next = aspace->slb_cache_next;
+    aspace->slb_cache[next % ARCH_ASPACE_SLB_CACHE] = esid;
+    aspace->slb_cache_next = next + 1;
+  }
+  return true;
+}
+
+static void slb_switch(arch_aspace_t *aspace) {
+  // never cleared, the TLB keeps translations of aspaces switched away from
+  if (aspace) atomic_or(&aspace->cpu_mask, 1 << arch_curr_cpu_num());
+  if (!slb_size) return;
+
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  struct slb_cpu *c = PPC64_PACA_LD(slb);
+  if (c->aspace != aspace) {
+    // the old context's translations stay in the HPT and TLB, its vsids just go unused
+    slb_flush_user(c);
+    c->aspace = aspace;
+    if (aspace) {
+      for (uint i = 0; i < ARCH_ASPACE_SLB_CACHE; i++) {
+        if (aspace->slb_cache[i]) slb_insert(c, aspace, aspace->slb_cache[i] & ~SLB_ESID_V);
+      }
+      __asm__ volatile("isync" ::: "memory");
+    }
+  }
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static uint slb_size_for_cpu(void) {
+  const struct ppc64_fdt_info *fdt = ppc64_fdt();
+  if (fdt && fdt->slb_size) return fdt->slb_size < SLB_MAX ? fdt->slb_size : SLB_MAX;
+
+  switch (pvr_read() >> 16) {
+    case 0x004b: case 0x004c: case 0x004d: // power8
+    case 0x004e: case 0x0080:              // power9, 10
+      return 32;
+    default:
+      return 64;
+  }
+}
+
+static void slb_bolt(vaddr_t va) {
+  uint64_t esid = ROUNDDOWN(va, 1ULL << SEGMENT_SHIFT);
+  for (uint i = 0; i < slb_bolted; i++) {
+    if (slb_bolted_esid[i] == esid) return;
+  }
+  if (slb_bolted < SLB_BOLTED_MAX) slb_bolted_esid[slb_bolted++] = esid;
+}
+
+static void slb_init_percpu(uint level) {
+  ppc64_paca()->slb = &slb_cpus[arch_curr_cpu_num()];
+  if (!kernel_aspace) return;
+
+  if (arch_curr_cpu_num() == 0) {
+    extern uint8_t _start;
+
+    slb_size = slb_size_for_cpu();
+    // text in slot 0, slbia never touches it
+    slb_bolt((vaddr_t)&_start);
+    slb_bolt((vaddr_t)__builtin_frame_address(0));
+    for (vaddr_t va = 0; va < linear_end; va += 1ULL << SEGMENT_SHIFT) slb_bolt(va);
+  }
+
+  struct slb_cpu *c = ppc64_paca()->slb;
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  // drop whatever the loader left, then slot 0 is the only one slbia spares
+  __asm__ volatile("slbia" ::: "memory");
+  memset(c, 0, sizeof(*c));
+  for (uint i = 0; i < slb_bolted; i++) slb_write(c, i, kernel_aspace, slb_bolted_esid[i]);
+  c->next = slb_bolted;
+  __asm__ volatile("isync" ::: "memory");
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+LK_INIT_HOOK_FLAGS(ppc64_slb, slb_init_percpu, LK_INIT_LEVEL_HEAP + 1, LK_INIT_FLAG_ALL_CPUS);
+
+// every 64 bit book3s cpu since the 970 does 16MB pages, 64KB came with POWER5+
+// xenon has both too, but its HID6 page size selection is left to the loader
+static const struct mmu_psize *linear_psize_for_cpu(void) {
+#ifdef PPC64_LINEAR_PAGE_SHIFT
+  switch (PPC64_LINEAR_PAGE_SHIFT) {
+    case 16: return &psize_64k;
+    case 24: return &psize_16m;
+    default: return &psize_4k;
+  }
+#else
+  switch (pvr_read() >> 16) {
+    case 0x0039: case 0x003c: case 0x0044: case 0x0045: // 970, fx, mp, gx
+    case 0x003a: case 0x003b: case 0x003e: case 0x003f: // power5, 5+, 6, 7
+    case 0x004a: case 0x004b: case 0x004c: case 0x004d: // power7+, 8e, 8nvl, 8
+    case 0x004e: case 0x0080:                           // power9, 10
+    case 0x0070: case 0x0071:                           // cell, xenon
+      return &psize_16m;
+    default:
+      return &psize_4k;
+  }
+#endif
+}
+
+// covers RAM from 0, the kernel aspace keeps its 4K mappings above linear_end
+static void linear_map_init(uint64_t ram_end) {
+  extern uint8_t _end;
+
+  linear_psize = linear_psize_for_cpu();
+  if ((uint64_t)&_end > ram_end) ram_end = (uint64_t)&_end;
+  linear_ram = ROUNDUP(ram_end, 1ULL << linear_psize->shift);
+  linear_end = ROUNDUP(ram_end, 1ULL << SEGMENT_SHIFT);
+}
+
+static void linear_map_bolt(void) {
+  extern uint8_t _start, __end_text;
+
+  // large pages are few enough to bolt outright, 4K pages only bolt the text
+  uint64_t page = 1ULL << linear_psize->shift;
+  vaddr_t start = 0, end = linear_ram;
+  if (linear_psize == &psize_4k) {
+    start = ROUNDDOWN((vaddr_t)&_start, page);
+    end = ROUNDUP((vaddr_t)&__end_text, page);
+  }
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&hpt_lock, state);
+  for (vaddr_t va = start; va < end; va += page) {
+    uint64_t vpn = mmu_vpn(ppc64_mmu_vsid(kernel_aspace, va), va);
+    hpt_insert(vpn, linear_psize->shift, linear_hpte_r(va), true);
+  }
+  hpt_unlock(state);
+
+  dprintf(INFO, "hpt: linear map of %llu MB in %llu KB pages, %llu bolted\n", linear_end >> 20,
+      page >> 10, (uint64_t)(end - start) >> linear_psize->shift);
+}
+
+// memory / 128 rounded up to a power of two, 256KB at least, the same ratio linux uses
+static uint hpt_shift_for(uint64_t memsize) {
+  uint shift = 64 - __builtin_clzll(memsize - 1);
+  return shift - 7 < 18 ? 18 : shift - 7;
+}
+
+// H_READ past the end of the table is H_PARAMETER, so the size is the first power of two
+// whose first entry cant be read
+static uint lpar_probe_shift(void) {
+  uint64_t ret[4];
+  uint shift = 18;
+  while (shift < 46 && do_hypercall_ret4(H_READ, 0, (1ULL << shift) / sizeof(struct hpte), 0, 0, ret) == H_SUCCESS) {
+    shift++;
+  }
+  return shift;
+}
+
+static void hpt_init(uint level) {
+#if !WITH_KERNEL_VM
+  // nothing else creates the kernel aspace without the vmm
+  static arch_aspace_t boot_aspace;
+  arch_mmu_init_aspace(&boot_aspace, 0, 1ULL << (PAGE_SIZE_SHIFT + PT_SHIFT * PT_LEVELS), ARCH_ASPACE_FLAG_KERNEL);
+#endif
+
+#ifdef MEMSIZE
+  uint64_t memsize = MEMSIZE;
+#else
+  uint64_t memsize = 256 << 20;
+#endif
+#ifdef MEMBASE
+  uint64_t ram_end = MEMBASE + memsize;
+#else
+  uint64_t ram_end = memsize;
+#endif
+  // the device tree knows better, the platform's arenas stop at the same limit
+  const struct ppc64_fdt_info *fdt = ppc64_fdt();
+  if (ppc64_fdt_ram_end()) {
+    ram_end = ppc64_fdt_ram_end() < PPC64_LINEAR_MAX ? ppc64_fdt_ram_end() : PPC64_LINEAR_MAX;
+    memsize = ram_end;
+  }
+  linear_map_init(ram_end);
+
+  if (!(msr_read() & MSR_HV)) {
+    // under an LPAR the hypervisor owns the HPT, only its size is ours to find out
+    hpt_shift = fdt && fdt->pft_shift ? fdt->pft_shift : lpar_probe_shift();
+    hpt_mask = (1ULL << hpt_shift) / sizeof(struct hpte) / HPTES_PER_GROUP - 1;
+    hpt_lpar = true;
+    dprintf(INFO, "hpt: %llu KB owned by the hypervisor, %llu groups\n", (1ULL << hpt_shift) >> 10,
+        hpt_mask + 1);
+    linear_map_bolt();
+    return;
+  }
+
+  // SDR1 wants the table aligned to its own size, a buddy block always is, the heap has to
+  // scan for it. settle for less if neither can do it
+  for (uint shift = hpt_shift_for(memsize); shift >= 18; shift--) {
+    hpt = ppc64_buddy_alloc(1ULL << shift);
+    if (!hpt) hpt = memalign(1ULL << shift, 1ULL << shift);
+    if (hpt) {
+      hpt_shift = shift;
+      break;
+    }
+  }
+  if (!hpt) panic("hpt: no memory for the smallest table\n");
+
+  uint64_t slots = (1ULL << hpt_shift) / sizeof(struct hpte);
+  hpt_rmap = calloc(slots, sizeof(uint64_t));
+  if (!hpt_rmap) panic("hpt: no memory for the reverse map\n");
+  memset(hpt, 0, 1ULL << hpt_shift);
+  hpt_mask = slots / HPTES_PER_GROUP - 1;
+
+  __asm__ volatile("ptesync" ::: "memory");
+  sdr1_write((uint64_t)hpt | (hpt_shift - 18));
+  __asm__ volatile("isync");
+
+  dprintf(INFO, "hpt: %llu KB at %p, %llu groups\n", (1ULL << hpt_shift) >> 10, hpt, hpt_mask + 1);
+
+  linear_map_bolt();
+}
+
+LK_INIT_HOOK(ppc64_hpt, hpt_init, LK_INIT_LEVEL_HEAP);
+
+static int cmd_hpt(int argc, const console_cmd_args *argv) {
+  if (!hpt_present()) {
+    printf("no hpt\n");
+    return 0;
+  }
+
+  if (hpt_lpar) {
+    // occupancy would take an H_READ per 4 slots
+    printf("hpt owned by the hypervisor, %llu KB, %llu groups\n", (1ULL << hpt_shift) >> 10, hpt_mask + 1);
+    printf("%llu inserts, %llu secondary, %llu evictions, %llu refill faults, %llu hcalls\n",
+        hpt_stats.inserts, hpt_stats.secondary, hpt_stats.evictions, hpt_stats.faults, hpt_stats.hcalls);
+    return 0;
+  }
+
+  uint64_t slots = (hpt_mask + 1) * HPTES_PER_GROUP;
+  uint64_t used = 0, bolted = 0, full_groups = 0;
+  for (uint64_t group = 0; group <= hpt_mask; group++) {
+    uint in_group = 0;
+    for (uint i = 0; i < HPTES_PER_GROUP; i++) {
+      uint64_t v = hpt[group * HPTES_PER_GROUP + i].v;
+      if (v & HPTE_V_VALID) in_group++;
+      if (v & HPTE_V_BOLTED) bolted++;
+    }
+    used += in_group;
+    if (in_group == HPTES_PER_GROUP) full_groups++;
+  }
+
+  printf("hpt %p, %llu KB, %llu groups\n", hpt, (1ULL << hpt_shift) >> 10, hpt_mask + 1);
+  printf("linear map 0-0x%lx in %u KB pages, %u of %u slb slots bolted\n", linear_end,
+      (1U << linear_psize->shift) >> 10, slb_bolted, slb_size);
+  printf("%u of %u contexts in use\n", context_used, CONTEXT_COUNT);
+  printf("%llu / %llu slots used, %llu bolted, %llu full groups\n", used, slots, bolted, full_groups);
+  printf("%llu inserts, %llu secondary, %llu evictions, %llu refill faults\n",
+      hpt_stats.inserts, hpt_stats.secondary, hpt_stats.evictions, hpt_stats.faults);
+  printf("lazy: %llu pages faulted in, %llu zero page maps\n", lazy_stats.pages, lazy_stats.zero_maps);
+  return 0;
+}
+
+static int cmd_slb(int argc, const console_cmd_args *argv) {
+  for (uint slot = 0; slot < slb_size; slot++) {
+    uint64_t esid, vsid;
+    __asm__ volatile("slbmfee %0, %1" : "=r"(esid) : "r"((uint64_t)slot));
+    __asm__ volatile("slbmfev %0, %1" : "=r"(vsid) : "r"((uint64_t)slot));
+    if (!(esid & SLB_ESID_V)) continue;
+    printf("%2u%c esid 0x%09llx vsid 0x%09llx%s%s%s\n", slot, slot < slb_bolted ? '*' : ' ',
+        esid >> SEGMENT_SHIFT, vsid >> SLB_VSID_SHIFT, (vsid & SLB_VSID_KS) ? " ks" : "",
+        (vsid & SLB_VSID_KP) ? " kp" : "", (vsid & SLB_VSID_L) ? " large" : "");
+  }
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("hpt", "hashed page table occupancy and stats", &cmd_hpt)
+STATIC_COMMAND("slb", "this cpu's segment lookaside buffer, * marks bolted slots", &cmd_slb)
+STATIC_COMMAND_END(hpt);
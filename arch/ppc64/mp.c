@@ -0,0 +1,99 @@
+#include <arch/atomic.h>
+#include <arch/cpu_regs.h>
+#include <arch/mp.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <arch/tlb.h>
+#include <kernel/mp.h>
+#include <kernel/thread.h>
+#include <lk/err.h>
+#include <lk/init.h>
+#include <lk/main.h>
+#include <lk/trace.h>
+
+#define LOCAL_TRACE 0
+
+#if WITH_SMP
+// one bit per mp_ipi_t, per target cpu
+// the platform doorbell only says "look at your mailbox", idle cpus also poll it
+static volatile int ipi_pending[SMP_MAX_CPUS];
+
+__WEAK void platform_send_ipi(uint cpu) {
+}
+
+void ppc64_mp_send_arch_ipi(uint target_mask, uint bit) {
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    if (target_mask & (1U << cpu)) {
+      atomic_or(&ipi_pending[cpu], 1 << bit);
+      platform_send_ipi(cpu);
+    }
+  }
+}
+
+status_t arch_mp_send_ipi(mp_cpu_mask_t target, mp_ipi_t ipi) {
+  LTRACEF("target 0x%x, ipi %u\n", target, ipi);
+  ppc64_mp_send_arch_ipi(target, ipi);
+  return NO_ERROR;
+}
+
+void arch_mp_init_percpu(void) {
+}
+
+// drain this cpu's mailbox, called from the platform ipi handler
+enum handler_return ppc64_mp_ipi_irq(void) {
+  uint cpu = arch_curr_cpu_num();
+  int pending = atomic_swap(&ipi_pending[cpu], 0);
+
+  enum handler_return ret = INT_NO_RESCHEDULE;
+  if (pending & (1 << MP_IPI_GENERIC)) {
+    if (mp_mbx_generic_irq() == INT_RESCHEDULE) ret = INT_RESCHEDULE;
+  }
+  if (pending & (1 << MP_IPI_RESCHEDULE)) {
+    if (mp_mbx_reschedule_irq() == INT_RESCHEDULE) ret = INT_RESCHEDULE;
+  }
+  if (pending & (1 << PPC64_IPI_PROFILE)) {
+    ppc64_profile_sync();
+  }
+  if (pending & (1 << PPC64_IPI_TLB)) {
+    ppc64_tlb_shootdown_irq();
+  }
+  if (pending & (1 << PPC64_IPI_IDLE)) {
+    ppc64_idle_sync();
+  }
+  return ret;
+}
+
+bool ppc64_mp_ipi_pending(void) {
+  return ipi_pending[arch_curr_cpu_num()] != 0;
+}
+
+void ppc64_mp_poll_ipi(void) {
+  if (!ppc64_mp_ipi_pending()) return;
+
+  arch_disable_ints();
+  if (ppc64_mp_ipi_irq() == INT_RESCHEDULE) thread_preempt();
+  arch_enable_ints();
+}
+
+// called from _secondary_start, on the per-cpu boot stack
+void ppc64_secondary_entry(uint cpu) {
+  if (cpu != pir_read()) {
+    // started with a cpu number that doesnt match PIR, the stack and paca we have belong to someone else
+    for (;;);
+  }
+
+  ppc64_timebase_take();
+
+  // whatever RTAS left in the decrementer, park it until the timer code arms it
+  dec_write(0x7fffffff);
+
+  // run early secondary cpu init routines up to the threading level
+  lk_init_level(LK_INIT_FLAG_SECONDARY_CPUS, LK_INIT_LEVEL_EARLIEST, LK_INIT_LEVEL_THREADING - 1);
+
+  arch_mp_init_percpu();
+
+  LTRACEF("cpu num %u\n", cpu);
+
+  lk_secondary_cpu_entry();
+}
+#endif
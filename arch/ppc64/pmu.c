@@ -0,0 +1,337 @@
+#include <arch/atomic.h>
+#include <arch/cpu_regs.h>
+#include <arch/iframe.h>
+#include <arch/ops.h>
+#include <arch/pmu.h>
+#include <arch/ppc64.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lib/console.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/init.h>
+#include <platform.h>
+#include <stdio.h>
+#include <string.h>
+
+// book3s performance monitor, ISA 2.07 and later layout
+// PMC1-4 count the generic events in enum order, PMC5/6 stay frozen
+// counters are 32 bits, a counter going negative raises 0xf00 and gets folded into 64 bit totals
+
+#define MMCR0_FC      (1ULL << 31) // freeze all counters
+#define MMCR0_PMXE    (1ULL << 26) // enable the performance monitor exception
+#define MMCR0_FCECE   (1ULL << 25) // freeze when the exception condition hits
+#define MMCR0_PMC1CE  (1ULL << 15) // PMC1 negative is a condition
+#define MMCR0_PMCjCE  (1ULL << 14) // PMC2-6 negative is a condition
+#define MMCR0_PMAO    (1ULL << 7)  // alert occurred, cleared by writing MMCR0
+#define MMCR0_FC56    (1ULL << 4)  // freeze PMC5/6
+
+#define MMCR0_RUN     (MMCR0_PMXE | MMCR0_FCECE | MMCR0_PMC1CE | MMCR0_PMCjCE | MMCR0_FC56)
+#define MMCR0_FROZEN  (MMCR0_RUN | MMCR0_FC)
+
+#define MMCR1_UNIT(pmc, unit) ((uint64_t)(unit) << (60 - 4 * ((pmc) - 1)))
+#define MMCR1_SEL(pmc, sel)   ((uint64_t)(sel) << (24 - 8 * ((pmc) - 1)))
+
+// PM_CYC 0x1e, PM_INST_CMPL 0x02, PM_LD_MISS_L1 0x3e054, PM_BR_MPRED_CMPL 0x400f6
+#define ISA207_MMCR1 (MMCR1_SEL(1, 0x1e) | MMCR1_SEL(2, 0x02) | \
+                      MMCR1_UNIT(3, 0xe) | MMCR1_SEL(3, 0x54) | MMCR1_SEL(4, 0xf6))
+
+struct pmu_model {
+  const char *name;
+  uint32_t pvr_version;
+  uint64_t mmcr1;
+};
+
+// 970 and xenon use a different MMCR1 layout, and qemu only models the 2.07+ PMU anyway
+static const struct pmu_model models[] = {
+  { "power8e", 0x004b, ISA207_MMCR1 },
+  { "power8nvl", 0x004c, ISA207_MMCR1 },
+  { "power8", 0x004d, ISA207_MMCR1 },
+  { "power9", 0x004e, ISA207_MMCR1 },
+  { "power10", 0x0080, ISA207_MMCR1 },
+};
+
+static const struct pmu_model *model;
+
+static const char *event_names[PMU_EVENT_COUNT] = {
+  [PMU_CYCLES] = "cycles",
+  [PMU_INSTRUCTIONS] = "instructions",
+  [PMU_L1D_MISSES] = "l1d-misses",
+  [PMU_BRANCH_MISSES] = "branch-misses",
+};
+
+struct pmu_cpu {
+  bool cpu_wide;
+  bool sampling;
+  uint64_t count[PMU_EVENT_COUNT];
+} __ALIGNED(CACHE_LINE);
+
+static struct pmu_cpu pmu_cpu[SMP_MAX_CPUS];
+
+// number of thread and cpu sessions, context switches skip everything while it is 0
+static volatile int sessions;
+
+// nonzero while the profiler samples off PMC1
+static volatile uint32_t sample_period;
+
+bool pmu_supported(void) {
+  return model != NULL;
+}
+
+const char *pmu_event_name(enum pmu_event event) {
+  return event < PMU_EVENT_COUNT ? event_names[event] : "?";
+}
+
+static void pmu_run(void) {
+  pmc1_write(0);
+  pmc2_write(0);
+  pmc3_write(0);
+  pmc4_write(0);
+  mmcr0_write(MMCR0_RUN);
+}
+
+// freeze, and fold the hardware counters into count[]
+static void pmu_fold(uint64_t *count) {
+  mmcr0_write(MMCR0_FROZEN);
+  __asm__ volatile("isync");
+  count[PMU_CYCLES] += (uint32_t)pmc1_read();
+  count[PMU_INSTRUCTIONS] += (uint32_t)pmc2_read();
+  count[PMU_L1D_MISSES] += (uint32_t)pmc3_read();
+  count[PMU_BRANCH_MISSES] += (uint32_t)pmc4_read();
+}
+
+void ppc64_pmu_switch(struct arch_thread *old, struct arch_thread *new) {
+  if (sessions == 0) return;
+  if (pmu_cpu[arch_curr_cpu_num()].cpu_wide) return;
+
+  if (old->pmu_counting) pmu_fold(old->pmu_count);
+  if (new->pmu_counting) pmu_run();
+}
+
+// PMC1 goes negative after period cycles, PMC2-4 count along but raise nothing
+static void pmu_sample_arm(void) {
+  pmc1_write(0x80000000 - sample_period);
+  mmcr0_write(MMCR0_PMXE | MMCR0_FCECE | MMCR0_PMC1CE | MMCR0_FC56);
+}
+
+status_t pmu_sample_start(uint32_t period) {
+  if (!model) return ERR_NOT_SUPPORTED;
+  if (period == 0 || period >= 0x80000000) return ERR_INVALID_ARGS;
+  if (sessions || sample_period) return ERR_BUSY;
+
+  sample_period = period;
+  return NO_ERROR;
+}
+
+void pmu_sample_stop(void) {
+  sample_period = 0;
+}
+
+void pmu_sample_sync(void) {
+  struct pmu_cpu *c = &pmu_cpu[arch_curr_cpu_num()];
+  if (!model) return;
+
+  if (sample_period) {
+    c->sampling = true;
+    pmu_sample_arm();
+  } else if (c->sampling) {
+    c->sampling = false;
+    mmcr0_write(MMCR0_FROZEN);
+  }
+}
+
+// 0xf00, a counter went negative
+void ppc64_pmu_irq(struct ppc64_iframe *frame) {
+  struct pmu_cpu *c = &pmu_cpu[arch_curr_cpu_num()];
+  struct arch_thread *a = &get_current_thread()->arch;
+
+  if (c->sampling) {
+    // the profiler already took its sample
+    pmu_sample_arm();
+  } else if (c->cpu_wide) {
+    pmu_fold(c->count);
+    pmu_run();
+  } else if (a->pmu_counting) {
+    pmu_fold(a->pmu_count);
+    pmu_run();
+  } else {
+    // stale alert, MMCR0 write clears PMAO
+    mmcr0_write(MMCR0_FROZEN);
+  }
+}
+
+status_t pmu_thread_start(thread_t *t) {
+  if (!model) return ERR_NOT_SUPPORTED;
+
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  status_t ret = NO_ERROR;
+  if (sample_period) {
+    ret = ERR_BUSY;
+  } else if (t == get_current_thread() && pmu_cpu[arch_curr_cpu_num()].cpu_wide) {
+    ret = ERR_BUSY;
+  } else if (!t->arch.pmu_counting) {
+    memset(t->arch.pmu_count, 0, sizeof(t->arch.pmu_count));
+    t->arch.pmu_counting = true;
+    atomic_add(&sessions, 1);
+    if (t == get_current_thread()) pmu_run();
+  }
+
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+  return ret;
+}
+
+// a thread running on another cpu is only current as of its last context switch
+void pmu_thread_read(thread_t *t, struct pmu_counts *counts) {
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  if (t->arch.pmu_counting && t == get_current_thread()) {
+    pmu_fold(t->arch.pmu_count);
+    pmu_run();
+  }
+  memcpy(counts->count, t->arch.pmu_count, sizeof(counts->count));
+
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void pmu_thread_stop(thread_t *t, struct pmu_counts *counts) {
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  if (t->arch.pmu_counting) {
+    if (t == get_current_thread()) pmu_fold(t->arch.pmu_count);
+    t->arch.pmu_counting = false;
+    atomic_add(&sessions, -1);
+  }
+  if (counts) memcpy(counts->count, t->arch.pmu_count, sizeof(counts->count));
+
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+status_t pmu_cpu_start(void) {
+  if (!model) return ERR_NOT_SUPPORTED;
+
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  status_t ret = NO_ERROR;
+  struct pmu_cpu *c = &pmu_cpu[arch_curr_cpu_num()];
+  if (sample_period || c->cpu_wide || get_current_thread()->arch.pmu_counting) {
+    ret = ERR_BUSY;
+  } else {
+    memset(c->count, 0, sizeof(c->count));
+    c->cpu_wide = true;
+    atomic_add(&sessions, 1);
+    pmu_run();
+  }
+
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+  return ret;
+}
+
+void pmu_cpu_read(struct pmu_counts *counts) {
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  struct pmu_cpu *c = &pmu_cpu[arch_curr_cpu_num()];
+  if (c->cpu_wide) {
+    pmu_fold(c->count);
+    pmu_run();
+  }
+  memcpy(counts->count, c->count, sizeof(counts->count));
+
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+void pmu_cpu_stop(struct pmu_counts *counts) {
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  struct pmu_cpu *c = &pmu_cpu[arch_curr_cpu_num()];
+  if (c->cpu_wide) {
+    pmu_fold(c->count);
+    c->cpu_wide = false;
+    atomic_add(&sessions, -1);
+  }
+  if (counts) memcpy(counts->count, c->count, sizeof(counts->count));
+
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static void pmu_init_percpu(uint level) {
+  uint32_t version = pvr_read() >> 16;
+  for (size_t i = 0; i < countof(models); i++) {
+    if (models[i].pvr_version == version) model = &models[i];
+  }
+  if (!model) return;
+
+  mmcr0_write(MMCR0_FROZEN);
+  mmcra_write(0);
+  mmcr1_write(model->mmcr1);
+}
+
+LK_INIT_HOOK_FLAGS(ppc64_pmu, pmu_init_percpu, LK_INIT_LEVEL_ARCH_EARLY, LK_INIT_FLAG_ALL_CPUS);
+
+static int cmd_perf(int argc, const console_cmd_args *argv) {
+  bool cpu_wide = argc >= 2 && !strcmp(argv[1].str, "-c");
+  int first = cpu_wide ? 2 : 1;
+  if (argc <= first) {
+    printf("usage: %s [-c] <command> [args]\n", argv[0].str);
+    printf("  counts the shell thread while running command, -c counts the whole cpu instead\n");
+    printf("  `%s ut <case>` runs a unit test case\n", argv[0].str);
+    return -1;
+  }
+
+  char cmdline[256] = "";
+  for (int i = first; i < argc; i++) {
+    if (i > first) strlcat(cmdline, " ", sizeof(cmdline));
+    strlcat(cmdline, argv[i].str, sizeof(cmdline));
+  }
+
+  if (!model) printf("no PMU support for pvr 0x%08llx, timing only\n", pvr_read());
+
+#if WITH_SMP
+  thread_t *self = get_current_thread();
+  int old_pin = self->pinned_cpu;
+  if (cpu_wide) thread_set_pinned_cpu(self, arch_curr_cpu_num());
+#endif
+
+  status_t err = cpu_wide ? pmu_cpu_start() : pmu_thread_start(get_current_thread());
+  lk_bigtime_t start = current_time_hires();
+  int ret = console_run_script_locked(console_get_current(), cmdline);
+  lk_bigtime_t elapsed = current_time_hires() - start;
+
+  struct pmu_counts counts = {};
+  if (cpu_wide) {
+    pmu_cpu_stop(&counts);
+  } else {
+    pmu_thread_stop(get_current_thread(), &counts);
+  }
+
+#if WITH_SMP
+  if (cpu_wide) thread_set_pinned_cpu(self, old_pin);
+#endif
+
+  printf("\n performance counter stats for '%s'%s:\n\n", cmdline, cpu_wide ? " (cpu wide)" : "");
+  if (err == NO_ERROR) {
+    for (int i = 0; i < PMU_EVENT_COUNT; i++) {
+      printf("%16llu  %s", counts.count[i], event_names[i]);
+      if (i == PMU_INSTRUCTIONS && counts.count[PMU_CYCLES]) {
+        uint64_t ipc100 = counts.count[PMU_INSTRUCTIONS] * 100 / counts.count[PMU_CYCLES];
+        printf("  # %llu.%02llu insn per cycle", ipc100 / 100, ipc100 % 100);
+      }
+      printf("\n");
+    }
+  } else if (model) {
+    printf("  counters unavailable: %d\n", err);
+  }
+  printf("\n%9llu.%06llu seconds elapsed, command returned %d\n", elapsed / 1000000, elapsed % 1000000, ret);
+  return ret;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("perf", "count cycles, instructions, l1d and branch misses of a command", &cmd_perf)
+STATIC_COMMAND_END(perf);
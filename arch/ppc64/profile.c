@@ -0,0 +1,254 @@
+#include <arch/iframe.h>
+#include <arch/ops.h>
+#include <arch/pmu.h>
+#include <arch/ppc64.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lib/console.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// statistical sampling profiler
+// every decrementer or PMC1 overflow records the interrupted pc, lr and thread into a per-cpu
+// buffer, `profile dump` prints raw histograms that scripts/profile.sh symbolizes against lk.elf
+// code running with EE clear is charged to wherever interrupts get re-enabled
+
+#define PROFILE_SAMPLES 4096 // per cpu
+#define PROFILE_NAME_LEN 16
+
+// the thread may be gone by the time of the dump, so its name is copied while it is current
+struct profile_sample {
+  uint64_t pc;
+  uint64_t lr;
+  thread_t *thread;
+  char name[PROFILE_NAME_LEN];
+};
+
+struct profile_cpu {
+  uint32_t count;
+  uint32_t dropped;
+  struct profile_sample *samples;
+} __ALIGNED(CACHE_LINE);
+
+static struct profile_cpu profile_cpu[SMP_MAX_CPUS];
+
+// 0x900 or 0xf00 while sampling, 0 when stopped
+static volatile uint64_t profile_vector;
+static uint64_t profile_period;
+static lk_bigtime_t profile_elapsed;
+
+void ppc64_profile_tick(const struct ppc64_iframe *frame) {
+  if (frame->vector != profile_vector) return;
+
+  struct profile_cpu *c = &profile_cpu[arch_curr_cpu_num()];
+  if (c->count == PROFILE_SAMPLES) {
+    c->dropped++;
+    return;
+  }
+  struct profile_sample *s = &c->samples[c->count++];
+  s->pc = frame->srr0;
+  s->lr = frame->lr;
+  thread_t *t = get_current_thread();
+  s->thread = t;
+  memcpy(s->name, t->name, PROFILE_NAME_LEN - 1);
+  s->name[PROFILE_NAME_LEN - 1] = '\0';
+}
+
+// per cpu, from the PPC64_IPI_PROFILE mailbox bit or directly on the calling cpu
+void ppc64_profile_sync(void) {
+  ppc64_timer_rearm();
+  pmu_sample_sync();
+}
+
+static void profile_sync_all(void) {
+#if WITH_SMP
+  ppc64_mp_send_arch_ipi(mp.active_cpus & ~(1U << arch_curr_cpu_num()), PPC64_IPI_PROFILE);
+#endif
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  ppc64_profile_sync();
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+}
+
+static status_t profile_start(uint64_t vector, uint64_t period) {
+  if (profile_vector) return ERR_BUSY;
+
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    struct profile_cpu *c = &profile_cpu[cpu];
+    if (!c->samples) {
+      c->samples = calloc(PROFILE_SAMPLES, sizeof(struct profile_sample));
+      if (!c->samples) return ERR_NO_MEMORY;
+    }
+    c->count = 0;
+    c->dropped = 0;
+  }
+
+  if (vector == 0xf00) {
+    status_t err = pmu_sample_start(period);
+    if (err < 0) return err;
+  } else {
+    ppc64_timer_set_sample_period(period);
+  }
+
+  profile_period = period;
+  profile_elapsed = current_time_hires();
+  __asm__ volatile("lwsync" ::: "memory");
+  profile_vector = vector;
+  profile_sync_all();
+  return NO_ERROR;
+}
+
+static void profile_stop(void) {
+  if (!profile_vector) return;
+
+  profile_vector = 0;
+  profile_elapsed = current_time_hires() - profile_elapsed;
+  ppc64_timer_set_sample_period(0);
+  pmu_sample_stop();
+  profile_sync_all();
+}
+
+static int cmp_pc(const void *a, const void *b) {
+  const struct profile_sample *x = a, *y = b;
+  return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+static int cmp_edge(const void *a, const void *b) {
+  const struct profile_sample *x = a, *y = b;
+  if (x->lr != y->lr) return x->lr < y->lr ? -1 : 1;
+  return cmp_pc(a, b);
+}
+
+// a thread_t freed and reused for another thread during the run is told apart by its name
+static int cmp_thread(const void *a, const void *b) {
+  const struct profile_sample *x = a, *y = b;
+  if (x->thread != y->thread) return x->thread < y->thread ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+// one line per distinct key, `<tag> <keys...> <count>`, the format scripts/profile.sh reads
+static void profile_dump(void) {
+  if (profile_vector) {
+    printf("profile still running, stop it first\n");
+    return;
+  }
+
+  uint total = 0, dropped = 0;
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    total += profile_cpu[cpu].count;
+    dropped += profile_cpu[cpu].dropped;
+  }
+  if (total == 0) {
+    printf("no samples\n");
+    return;
+  }
+
+  struct profile_sample *all = malloc(total * sizeof(*all));
+  if (!all) {
+    printf("out of memory\n");
+    return;
+  }
+  uint n = 0;
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    memcpy(&all[n], profile_cpu[cpu].samples, profile_cpu[cpu].count * sizeof(*all));
+    n += profile_cpu[cpu].count;
+  }
+
+  printf("profile: begin samples %u dropped %u period %llu elapsed_us %llu\n",
+      total, dropped, profile_period, profile_elapsed);
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    if (profile_cpu[cpu].count) printf("cpu %u %u\n", cpu, profile_cpu[cpu].count);
+  }
+
+  qsort(all, n, sizeof(*all), cmp_pc);
+  for (uint i = 0, run = 1; i < n; i++, run++) {
+    if (i + 1 == n || all[i + 1].pc != all[i].pc) {
+      printf("pc 0x%llx %u\n", all[i].pc, run);
+      run = 0;
+    }
+  }
+
+  qsort(all, n, sizeof(*all), cmp_edge);
+  for (uint i = 0, run = 1; i < n; i++, run++) {
+    if (i + 1 == n || cmp_edge(&all[i], &all[i + 1])) {
+      printf("edge 0x%llx 0x%llx %u\n", all[i].lr, all[i].pc, run);
+      run = 0;
+    }
+  }
+
+  qsort(all, n, sizeof(*all), cmp_thread);
+  for (uint i = 0, run = 1; i < n; i++, run++) {
+    if (i + 1 == n || cmp_thread(&all[i], &all[i + 1])) {
+      printf("thread %p %s %u\n", all[i].thread, all[i].name, run);
+      run = 0;
+    }
+  }
+  printf("profile: end\n");
+
+  free(all);
+}
+
+static int cmd_profile(int argc, const console_cmd_args *argv) {
+  if (argc < 2) {
+usage:
+    printf("usage:\n");
+    printf("%s start [dec [us] | pmu [cycles]]  sample every us of timebase (1000) or every n cycles (1000000)\n", argv[0].str);
+    printf("%s stop\n", argv[0].str);
+    printf("%s dump                           raw histogram, symbolize with scripts/profile.sh\n", argv[0].str);
+    printf("%s run <command> [args]           start with the defaults, run, stop and dump\n", argv[0].str);
+    return -1;
+  }
+
+  if (!strcmp(argv[1].str, "start") || !strcmp(argv[1].str, "run")) {
+    bool pmu = false;
+    uint64_t period = 0;
+    if (!strcmp(argv[1].str, "start") && argc >= 3) {
+      if (!strcmp(argv[2].str, "pmu")) {
+        pmu = true;
+      } else if (strcmp(argv[2].str, "dec")) {
+        goto usage;
+      }
+      if (argc >= 4) period = argv[3].u;
+    }
+    if (pmu) {
+      if (period == 0) period = 1000000;
+    } else {
+      if (period == 0) period = 1000;
+      period = period * ppc64_timebase_freq() / (1000 * 1000);
+    }
+
+    status_t err = profile_start(pmu ? 0xf00 : 0x900, period);
+    if (err < 0) {
+      printf("profile start failed: %d\n", err);
+      return err;
+    }
+    if (!strcmp(argv[1].str, "start")) return 0;
+
+    if (argc < 3) goto usage;
+    char cmdline[256] = "";
+    for (int i = 2; i < argc; i++) {
+      if (i > 2) strlcat(cmdline, " ", sizeof(cmdline));
+      strlcat(cmdline, argv[i].str, sizeof(cmdline));
+    }
+    int ret = console_run_script_locked(console_get_current(), cmdline);
+    profile_stop();
+    profile_dump();
+    return ret;
+  } else if (!strcmp(argv[1].str, "stop")) {
+    profile_stop();
+  } else if (!strcmp(argv[1].str, "dump")) {
+    profile_dump();
+  } else {
+    goto usage;
+  }
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("profile", "sampling profiler", &cmd_profile)
+STATIC_COMMAND_END(profile);
@@ -3,8 +3,11 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 TOOLCHAIN_PREFIX := powerpc64-unknown-linux-gnuabielfv2-
 ARCH_COMPILEFLAGS += -mcpu=powerpc64 -maltivec -mabi=altivec
-#ARCH_COMPILEFLAGS += -finstrument-functions
+# keep VRSAVE accurate, the lazy vmx switch only saves the registers it names
+ARCH_COMPILEFLAGS += -mvrsave
 # ARCH_LDFLAGS += -mcpu=powerpc64
+# string.c replaces the libc routines for every module outside lib/libc
+ARCH_LDFLAGS += --wrap=memcpy --wrap=memset --wrap=memmove --wrap=memcmp --wrap=bzero
 
 #LD := vc4-elf-ld
 #CC := vc4-elf-gcc
@@ -12,16 +15,50 @@ ARCH_COMPILEFLAGS += -mcpu=powerpc64 -maltivec -mabi=altivec
 #OBJDUMP := vc4-elf-objdump
 
 MODULE_SRCS += $(LOCAL_DIR)/boot.S $(LOCAL_DIR)/arch.c $(LOCAL_DIR)/thread.c $(LOCAL_DIR)/timer.c
+MODULE_SRCS += $(LOCAL_DIR)/buddy.c
+MODULE_SRCS += $(LOCAL_DIR)/cache.c $(LOCAL_DIR)/string.c
+MODULE_SRCS += $(LOCAL_DIR)/fdt.c
 
-MODULE_SRCS += $(LOCAL_DIR)/mmu.c
+MODULE_SRCS += $(LOCAL_DIR)/exceptions.S $(LOCAL_DIR)/exceptions.c
+MODULE_SRCS += $(LOCAL_DIR)/fpu.S $(LOCAL_DIR)/fpu.c
+MODULE_SRCS += $(LOCAL_DIR)/idle.c
+MODULE_SRCS += $(LOCAL_DIR)/mmu.c $(LOCAL_DIR)/tlb.c
+MODULE_SRCS += $(LOCAL_DIR)/pmu.c
+MODULE_SRCS += $(LOCAL_DIR)/slab.c
+MODULE_SRCS += $(LOCAL_DIR)/profile.c
+MODULE_SRCS += $(LOCAL_DIR)/trace.c
+MODULE_SRCS += $(LOCAL_DIR)/mp.c
 
 GLOBAL_DEFINES += PLATFORM_HAS_DYNAMIC_TIMER=1 ARCH_HAS_MMU=1 IS_64BIT=1
 
 ARCH_OPTFLAGS := -O1
 
+# function entry tracing, see trace.c and scripts/trace.sh
+#   TRACE_FUNCTIONS := all, or object directories under the build dir, e.g. "lk/kernel lk/top platform/qemu-ppc"
+#   TRACE_FUNCTIONS_BOOT := true records from the first instruction and stops when the ring fills,
+#   the rings move to .data for that, 128K per cpu of image at the default size
+# the arch headers, the string routines and the tracer itself are never instrumented, the hooks run through them
+TRACE_FUNCTIONS ?=
+ifneq ($(TRACE_FUNCTIONS),)
+  TRACE_COMPILEFLAGS := -finstrument-functions -finstrument-functions-exclude-file-list=arch/ppc64/include,arch/ppc64/string.c,arch/ppc64/trace.c
+  ifeq ($(TRACE_FUNCTIONS),all)
+    ARCH_COMPILEFLAGS += $(TRACE_COMPILEFLAGS)
+  else
+    $(foreach m,$(TRACE_FUNCTIONS),$(eval $(BUILDDIR)/$(m)/%.o: ARCH_COMPILEFLAGS += $(TRACE_COMPILEFLAGS)))
+  endif
+  GLOBAL_DEFINES += WITH_TRACE_FUNCTIONS=1
+  ifeq (true,$(call TOBOOL,$(TRACE_FUNCTIONS_BOOT)))
+    GLOBAL_DEFINES += TRACE_FUNCTIONS_BOOT=1
+  endif
+endif
+
 ifeq (true,$(call TOBOOL,$(WITH_KERNEL_VM)))
+  MODULE_SRCS += $(LOCAL_DIR)/zeropool.c
+
+  # [16M, 64G), RAM is linear mapped from the bottom, up to half of it, and 4K regions go in the
+  # segments above
   KERNEL_ASPACE_BASE := 0x1000000
-  KERNEL_ASPACE_SIZE := 0x1000000
+  KERNEL_ASPACE_SIZE := 0xfff000000
 
   GLOBAL_DEFINES += ARCH_HAS_MMU=1 KERNEL_ASPACE_BASE=$(KERNEL_ASPACE_BASE) KERNEL_ASPACE_SIZE=$(KERNEL_ASPACE_SIZE)
 endif
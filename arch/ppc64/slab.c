@@ -0,0 +1,246 @@
+#include <arch/defines.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <kernel/spinlock.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/init.h>
+#include <lk/list.h>
+#include <lk/trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
+
+#define LOCAL_TRACE 0
+
+// slab allocator for small kernel objects
+// every size class is a multiple of CACHE_LINE and objects start on a line, so two objects
+// never share one and hw threads working on different objects never bounce a line between them
+// each cpu keeps a magazine of free objects per class and only takes the class lock to move
+// half a magazine at a time to or from the slabs, the common alloc/free is a push or pop with
+// interrupts off
+// slabs are SLAB_SIZE aligned with their header in the first line, so the header of any
+// object is found by rounding down. larger requests get their own run of pages with the same
+// header, from the pmm with the vmm or from the heap without
+// thread context only, like malloc, growing may block
+
+#define SLAB_SHIFT 14
+#define SLAB_SIZE (1UL << SLAB_SHIFT)
+#define SLAB_HEADER CACHE_LINE
+#define SLAB_MAGIC 0x736c6162 // "slab"
+#define SLAB_LARGE 0xff
+
+#define MAGAZINE_SIZE 32
+
+struct slab {
+  uint magic;
+  uint class;
+  uint inuse;                // objects out of the slab, magazines included
+  size_t size;               // bytes of backing
+  void *free;                // free objects, linked through their first word
+  struct list_node node;     // on the class's partial list while it has free objects
+};
+_Static_assert(sizeof(struct slab) <= SLAB_HEADER, "slab header fits its line");
+
+struct slab_class {
+  uint size;
+  uint per_slab;
+  spin_lock_t lock;
+  struct list_node partial;
+  uint partial_count;
+  uint slabs;
+};
+
+static const uint class_sizes[] = { 128, 256, 384, 512, 768, 1024, 1536, 2048 };
+#define SLAB_CLASSES countof(class_sizes)
+
+static struct slab_class classes[SLAB_CLASSES];
+
+struct magazine {
+  uint count;
+  void *obj[MAGAZINE_SIZE];
+} __ALIGNED(CACHE_LINE);
+
+static struct magazine magazines[SMP_MAX_CPUS][SLAB_CLASSES];
+
+static void *backing_alloc(size_t size) {
+#if WITH_KERNEL_VM
+  paddr_t pa;
+  struct list_node pages = LIST_INITIAL_VALUE(pages);
+  uint count = size / PAGE_SIZE;
+  if (pmm_alloc_contiguous(count, SLAB_SHIFT, &pa, &pages) != count) return NULL;
+  return paddr_to_kvaddr(pa);
+#else
+  return memalign(SLAB_SIZE, size);
+#endif
+}
+
+static void backing_free(void *ptr, size_t size) {
+#if WITH_KERNEL_VM
+  pmm_free_kpages(ptr, size / PAGE_SIZE);
+#else
+  free(ptr);
+#endif
+}
+
+static inline struct slab *slab_of(const void *ptr) {
+  return (struct slab *)ROUNDDOWN((uintptr_t)ptr, SLAB_SIZE);
+}
+
+static int size_class(size_t size) {
+  for (uint i = 0; i < SLAB_CLASSES; i++) {
+    if (size <= class_sizes[i]) return i;
+  }
+  return -1;
+}
+
+// a fresh slab onto the partial list, nothing locked, may block
+static bool slab_grow(struct slab_class *cls) {
+  struct slab *s = backing_alloc(SLAB_SIZE);
+  if (!s) return false;
+
+  s->magic = SLAB_MAGIC;
+  s->class = cls - classes;
+  s->inuse = 0;
+  s->size = SLAB_SIZE;
+  s->free = NULL;
+  for (uint i = cls->per_slab; i > 0; i--) {
+    void **obj = (void **)((uintptr_t)s + SLAB_HEADER + (i - 1) * cls->size);
+    *obj = s->free;
+    s->free = obj;
+  }
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&cls->lock, state);
+  list_add_head(&cls->partial, &s->node);
+  cls->partial_count++;
+  cls->slabs++;
+  spin_unlock_irqrestore(&cls->lock, state);
+
+  LTRACEF("class %u slab %p\n", cls->size, s);
+  return true;
+}
+
+// half a magazine from the partial slabs
+static void magazine_fill(struct slab_class *cls, struct magazine *m) {
+  spin_lock(&cls->lock);
+  while (m->count < MAGAZINE_SIZE / 2) {
+    struct slab *s = list_peek_head_type(&cls->partial, struct slab, node);
+    if (!s) break;
+    void **obj = s->free;
+    s->free = *obj;
+    s->inuse++;
+    m->obj[m->count++] = obj;
+    if (!s->free) {
+      list_delete(&s->node);
+      cls->partial_count--;
+    }
+  }
+  spin_unlock(&cls->lock);
+}
+
+// half a magazine back to the slabs, slabs that end up empty go on the empty list when the
+// class has free objects elsewhere
+static void magazine_drain(struct slab_class *cls, struct magazine *m, struct list_node *empty) {
+  spin_lock(&cls->lock);
+  while (m->count > MAGAZINE_SIZE / 2) {
+    void **obj = m->obj[--m->count];
+    struct slab *s = slab_of(obj);
+    if (!s->free) {
+      list_add_tail(&cls->partial, &s->node);
+      cls->partial_count++;
+    }
+    *obj = s->free;
+    s->free = obj;
+    if (--s->inuse == 0 && cls->partial_count > 1) {
+      list_delete(&s->node);
+      cls->partial_count--;
+      cls->slabs--;
+      list_add_tail(empty, &s->node);
+    }
+  }
+  spin_unlock(&cls->lock);
+}
+
+void *ppc64_slab_alloc(size_t size) {
+  int c = size_class(size ? size : 1);
+  if (c < 0) {
+    size_t bytes = ROUNDUP(size + SLAB_HEADER, PAGE_SIZE);
+    struct slab *s = backing_alloc(bytes);
+    if (!s) return NULL;
+    s->magic = SLAB_MAGIC;
+    s->class = SLAB_LARGE;
+    s->size = bytes;
+    return (uint8_t *)s + SLAB_HEADER;
+  }
+
+  struct slab_class *cls = &classes[c];
+  for (;;) {
+    spin_lock_saved_state_t state;
+    arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+    struct magazine *m = &magazines[arch_curr_cpu_num()][c];
+    if (!m->count) magazine_fill(cls, m);
+    void *obj = m->count ? m->obj[--m->count] : NULL;
+    arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+    if (obj) return obj;
+    if (!slab_grow(cls)) return NULL;
+  }
+}
+
+void ppc64_slab_free(void *ptr) {
+  if (!ptr) return;
+
+  struct slab *s = slab_of(ptr);
+  DEBUG_ASSERT(s->magic == SLAB_MAGIC);
+  if (s->class == SLAB_LARGE) {
+    s->magic = 0;
+    backing_free(s, s->size);
+    return;
+  }
+
+  struct slab_class *cls = &classes[s->class];
+  struct list_node empty = LIST_INITIAL_VALUE(empty);
+
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  struct magazine *m = &magazines[arch_curr_cpu_num()][s->class];
+  if (m->count == MAGAZINE_SIZE) magazine_drain(cls, m, &empty);
+  m->obj[m->count++] = ptr;
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  while ((s = list_remove_head_type(&empty, struct slab, node))) {
+    s->magic = 0;
+    backing_free(s, SLAB_SIZE);
+  }
+}
+
+static void slab_init(uint level) {
+  for (uint i = 0; i < SLAB_CLASSES; i++) {
+    classes[i].size = class_sizes[i];
+    classes[i].per_slab = (SLAB_SIZE - SLAB_HEADER) / class_sizes[i];
+    spin_lock_init(&classes[i].lock);
+    list_initialize(&classes[i].partial);
+  }
+}
+
+// before anything can allocate
+LK_INIT_HOOK(ppc64_slab, slab_init, LK_INIT_LEVEL_EARLIEST);
+
+static int cmd_slab(int argc, const console_cmd_args *argv) {
+  printf("class  slabs partial  cached per cpu\n");
+  for (uint i = 0; i < SLAB_CLASSES; i++) {
+    const struct slab_class *cls = &classes[i];
+    printf("%5u %6u %7u ", cls->size, cls->slabs, cls->partial_count);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) printf(" %2u", magazines[cpu][i].count);
+    printf("\n");
+  }
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("slab", "slab allocator classes and per cpu magazines", &cmd_slab)
+STATIC_COMMAND_END(slab);
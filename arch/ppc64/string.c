@@ -0,0 +1,244 @@
+#include <altivec.h>
+#include <arch/cpu_regs.h>
+#include <arch/ppc64.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// memcpy/memset/memmove/memcmp/bzero for the big copies and fills: fb_init() clears a 3.6M
+// framebuffer, hpt_init() a 256K+ page table
+// the final link wraps the libc symbols (rules.mk), every module calls these and LK's C versions
+// are only left for calls from inside lib/libc
+//
+// size classes
+//   < SMALL_COPY          bytes, no setup
+//   < 2 lines             doublewords when both pointers agree mod 8
+//   whole lines           dcbz each destination line so it is never read for ownership, dcbt the
+//                         source PREFETCH_LINES ahead, 16 byte vmx loads and stores if usable
+//
+// vmx is used when the unit is already on, or external interrupts are on and the copy is long
+// enough to pay for the unavailable trap. every interrupt clears MSR.VEC and MSR.EE on entry, so
+// handlers never get here with either set and can't clobber the live vector state of the thread
+// they interrupted
+//
+// big endian only, the misaligned vmx loop realigns with lvsl/vperm
+
+// keep gcc from turning the byte loops back into calls to the functions they implement
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+#define SMALL_COPY 16
+#define VMX_MIN 4096
+#define PREFETCH_LINES 4
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+typedef __vector unsigned char vec_t;
+
+static inline void dcbt(const void *p) {
+  __asm__ volatile("dcbt 0, %0" :: "r"(p));
+}
+
+static inline void dcbtst(const void *p) {
+  __asm__ volatile("dcbtst 0, %0" :: "r"(p));
+}
+
+static inline void dcbz(void *p) {
+  __asm__ volatile("dcbz 0, %0" :: "r"(p) : "memory");
+}
+
+static bool vmx_usable(size_t n) {
+  uint64_t msr = msr_read();
+  if (msr & MSR_VEC) return true;
+  return (msr & MSR_EE) && n >= VMX_MIN;
+}
+
+static inline void copy_fwd(uint8_t *d, const uint8_t *s, size_t n) {
+  if (n >= SMALL_COPY && !(((uintptr_t)d ^ (uintptr_t)s) & 7)) {
+    for (; (uintptr_t)d & 7; n--) *d++ = *s++;
+    for (; n >= 8; n -= 8, d += 8, s += 8) *(word_t *)d = *(const word_t *)s;
+  }
+  while (n--) *d++ = *s++;
+}
+
+// d and s point one past the end
+static inline void copy_bwd(uint8_t *d, const uint8_t *s, size_t n) {
+  if (n >= SMALL_COPY && !(((uintptr_t)d ^ (uintptr_t)s) & 7)) {
+    for (; (uintptr_t)d & 7; n--) *--d = *--s;
+    for (; n >= 8; n -= 8) {
+      d -= 8;
+      s -= 8;
+      *(word_t *)d = *(const word_t *)s;
+    }
+  }
+  while (n--) *--d = *--s;
+}
+
+// d is line aligned, n a multiple of the line
+static void copy_lines(uint8_t *d, const uint8_t *s, size_t n, size_t line) {
+  for (; n; n -= line, d += line, s += line) {
+    dcbt(s + PREFETCH_LINES * line);
+    dcbz(d);
+    copy_fwd(d, s, line);
+  }
+}
+
+static void copy_lines_vmx(uint8_t *d, const uint8_t *s, size_t n, size_t line) {
+  if (!((uintptr_t)s & 15)) {
+    for (; n; n -= line, d += line, s += line) {
+      dcbt(s + PREFETCH_LINES * line);
+      dcbz(d);
+      for (size_t i = 0; i < line; i += 16) vec_st(vec_ld(i, s), i, d);
+    }
+    return;
+  }
+
+  // each store merges two aligned loads, the last load is the quadword holding s + n - 1 so
+  // nothing past the source is touched
+  vec_t perm = vec_lvsl(0, s);
+  vec_t prev = vec_ld(0, s);
+  for (; n; n -= line, d += line, s += line) {
+    dcbt(s + PREFETCH_LINES * line);
+    dcbz(d);
+    for (size_t i = 0; i < line; i += 16) {
+      vec_t next = vec_ld(i + 16, s);
+      vec_st(vec_perm(prev, next, perm), i, d);
+      prev = next;
+    }
+  }
+}
+
+static void set_lines(uint8_t *d, uint8_t c, size_t n, size_t line) {
+  if (!c) {
+    for (; n; n -= line, d += line) dcbz(d);
+    return;
+  }
+
+  if (vmx_usable(n)) {
+    vec_t v = vec_splats((unsigned char)c);
+    for (; n; n -= line, d += line) {
+      dcbz(d);
+      for (size_t i = 0; i < line; i += 16) vec_st(v, i, d);
+    }
+    return;
+  }
+
+  uint64_t v = c * 0x0101010101010101ULL;
+  for (; n; n -= line, d += line) {
+    dcbz(d);
+    for (size_t i = 0; i < line; i += 8) *(word_t *)(d + i) = v;
+  }
+}
+
+void *__wrap_memcpy(void *restrict dst, const void *restrict src, size_t n) {
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  size_t line = ppc64_dcache_line_size();
+
+  if (n >= 2 * line) {
+    size_t head = -(uintptr_t)d & (line - 1);
+    copy_fwd(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t body = n & ~(line - 1);
+    if (vmx_usable(body)) {
+      copy_lines_vmx(d, s, body, line);
+    } else {
+      copy_lines(d, s, body, line);
+    }
+    d += body;
+    s += body;
+    n -= body;
+  }
+  copy_fwd(d, s, n);
+  return dst;
+}
+
+void *__wrap_memset(void *dst, int c, size_t n) {
+  uint8_t *d = dst;
+  size_t line = ppc64_dcache_line_size();
+
+  if (n >= SMALL_COPY) {
+    uint64_t v = (uint8_t)c * 0x0101010101010101ULL;
+    for (; (uintptr_t)d & 7; n--) *d++ = c;
+    if (n >= 2 * line) {
+      for (; (uintptr_t)d & (line - 1); n -= 8, d += 8) *(word_t *)d = v;
+      size_t body = n & ~(line - 1);
+      set_lines(d, c, body, line);
+      d += body;
+      n -= body;
+    }
+    for (; n >= 8; n -= 8, d += 8) *(word_t *)d = v;
+  }
+  while (n--) *d++ = c;
+  return dst;
+}
+
+void __wrap_bzero(void *dst, size_t n) {
+  __wrap_memset(dst, 0, n);
+}
+
+// dcbz would destroy source bytes not yet read when the two overlap, only the disjoint case goes
+// through memcpy, the rest is prefetched one line at a time
+void *__wrap_memmove(void *dst, const void *src, size_t n) {
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  size_t line = ppc64_dcache_line_size();
+
+  if (d == s || !n) return dst;
+  if (d + n <= s || s + n <= d) return __wrap_memcpy(dst, src, n);
+
+  if (d < s) {
+    while (n) {
+      size_t chunk = n < line ? n : line;
+      dcbt(s + PREFETCH_LINES * line);
+      dcbtst(d + PREFETCH_LINES * line);
+      copy_fwd(d, s, chunk);
+      d += chunk;
+      s += chunk;
+      n -= chunk;
+    }
+  } else {
+    d += n;
+    s += n;
+    while (n) {
+      size_t chunk = n < line ? n : line;
+      dcbt(s - PREFETCH_LINES * line);
+      dcbtst(d - PREFETCH_LINES * line);
+      copy_bwd(d, s, chunk);
+      d -= chunk;
+      s -= chunk;
+      n -= chunk;
+    }
+  }
+  return dst;
+}
+
+int __wrap_memcmp(const void *a, const void *b, size_t n) {
+  const uint8_t *p = a;
+  const uint8_t *q = b;
+
+  // the wide loops only skip what is equal, the byte loop finds the first difference
+  if (n >= VMX_MIN && !(((uintptr_t)p | (uintptr_t)q) & 15) && vmx_usable(n)) {
+    size_t line = ppc64_dcache_line_size();
+    for (; n >= 16; n -= 16, p += 16, q += 16) {
+      if (!((uintptr_t)p & (line - 1))) {
+        dcbt(p + PREFETCH_LINES * line);
+        dcbt(q + PREFETCH_LINES * line);
+      }
+      if (!vec_all_eq(vec_ld(0, p), vec_ld(0, q))) break;
+    }
+  } else if (n >= SMALL_COPY && !(((uintptr_t)p ^ (uintptr_t)q) & 7)) {
+    for (; (uintptr_t)p & 7; n--, p++, q++) {
+      if (*p != *q) return *p - *q;
+    }
+    for (; n >= 8; n -= 8, p += 8, q += 8) {
+      if (*(const word_t *)p != *(const word_t *)q) break;
+    }
+  }
+
+  for (; n; n--, p++, q++) {
+    if (*p != *q) return *p - *q;
+  }
+  return 0;
+}
@@ -1,3 +1,5 @@
+#include <arch/cpu_regs.h>
+#include <arch/ppc64.h>
 #include <kernel/thread.h>
 #include <string.h>
 
@@ -15,6 +17,8 @@ void arch_thread_initialize(thread_t *t) {
   memset(&t->arch, 0, sizeof(struct arch_thread));
   t->arch.lr = (uint64_t)&initial_thread_func;
   t->arch.sp = (uint64_t)((t->stack + t->stack_size) - 32);
+  // starts translated if its creator is
+  t->arch.msr = msr_read() & (MSR_IR | MSR_DR);
   //printf("&lr %p\n", &t->arch.lr);
 }
 
@@ -24,5 +28,10 @@ void arch_dump_thread(thread_t *t) {
 void ppc64_context_switch(struct arch_thread *oldsp, struct arch_thread *newsp);
 
 void arch_context_switch(thread_t *oldthread, thread_t *newthread) {
+  ppc64_fpu_switch(&oldthread->arch, &newthread->arch);
+  ppc64_pmu_switch(&oldthread->arch, &newthread->arch);
+#if WITH_TRACE_FUNCTIONS
+  ppc64_trace_switch(newthread);
+#endif
   ppc64_context_switch(&oldthread->arch, &newthread->arch);
 }
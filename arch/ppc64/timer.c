@@ -1,20 +1,215 @@
 #include <platform/timer.h>
+#include <arch/atomic.h>
 #include <arch/cpu_regs.h>
+#include <arch/defines.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <lk/debug.h>
 #include <lk/err.h>
+#include <lk/init.h>
 #include <stdio.h>
 
+// DEC is a signed 32bit down counter, anything further out is reached in several hops
+#define DEC_MAX 0x7fffffff
+#define DEADLINE_NONE UINT64_MAX
+
+// the kernel timer queue is already sorted per cpu and only calls us when its head changes
+// this just maps the head deadline onto this cpu's decrementer
+struct oneshot {
+  platform_timer_callback callback;
+  void *arg;
+  uint64_t deadline; // absolute timebase
+} __ALIGNED(CACHE_LINE);
+
+static struct oneshot oneshot[SMP_MAX_CPUS];
+
+// nonzero while the profiler samples off the decrementer, caps every DEC write
+static volatile uint64_t dec_sample_period;
+
+// timebase conversions, x = tb * mult >> 63, a mulld + mulhdu and no divide on reads
+// with a 63 bit shift the truncation error stays below 1ppb for any timebase over 1MHz
+struct tb_conv {
+  uint64_t freq;
+  uint64_t us_mult;
+  uint64_t ms_mult;
+};
+
+static struct tb_conv tb_conv;
+
+static inline uint64_t tb_scale(uint64_t tb, uint64_t mult) {
+  return ((unsigned __int128)tb * mult) >> 63;
+}
+
+static uint64_t tb_mult(uint64_t units_per_sec, uint64_t freq) {
+  return ((unsigned __int128)units_per_sec << 63) / freq;
+}
+
+// the first tick current_time() calls ms, rounded up from the same mult so the two agree
+// however the frequency divides. freq / 1000 would lose freq % 1000 ticks every second
+static uint64_t tb_from_ms(uint64_t ms) {
+  unsigned __int128 x = (unsigned __int128)ms << 63;
+  return (x + tb_conv.ms_mult - 1) / tb_conv.ms_mult;
+}
+
+void ppc64_timebase_set_freq(uint64_t freq) {
+  tb_conv.freq = freq;
+  tb_conv.us_mult = tb_mult(1000 * 1000, freq);
+  tb_conv.ms_mult = tb_mult(1000, freq);
+  dprintf(INFO, "timebase %llu Hz\n", freq);
+}
+
+uint64_t ppc64_timebase_freq(void) {
+  return tb_conv.freq;
+}
+
+// used until the platform or device tree says otherwise
+static uint64_t timebase_freq_from_pvr(void) {
+  switch (pvr_read() >> 16) {
+    case 0x0071: // xenon
+      return 50 * 1000 * 1000;
+    default:
+      // qemu pseries runs every server cpu model at 512MHz
+      return 512 * 1000 * 1000;
+  }
+}
+
+void ppc64_timebase_init(void) {
+  ppc64_timebase_set_freq(timebase_freq_from_pvr());
+}
+
 lk_bigtime_t current_time_hires(void) {
-  return tbl_read()/50;
+  return tb_scale(tbl_read(), tb_conv.us_mult);
 }
 
 lk_time_t current_time(void) {
-  return tbl_read()/50/1000;
+  return tb_scale(tbl_read(), tb_conv.ms_mult);
+}
+
+// timebase handoff for cpus that come up with their own timebase, one secondary at a time
+// writing TB needs MSR.HV, under pseries the hypervisor keeps every vcpu in step already
+// the residual skew is one cache line transfer between the two cpus
+// READY and GO carry the secondary's cpu number, so a late secondary's READY is never taken for
+// the next one's, and both sides give up after TB_HANDOFF_TIMEOUT of their own timebase
+enum {
+  TB_IDLE,
+  TB_READY, // secondary is spinning, waiting for a value
+  TB_GO,    // value published
+};
+#define TB_STATE(cpu, s) ((int)((cpu) << 8 | (s)))
+#define TB_HANDOFF_TIMEOUT_MS 100
+
+static struct {
+  volatile int state;
+  volatile uint64_t tb;
+} tb_handoff __ALIGNED(CACHE_LINE);
+
+// the secondary's timebase is whatever it came up with, only differences mean anything
+static bool tb_handoff_expired(uint64_t start) {
+  return tbl_read() - start > TB_HANDOFF_TIMEOUT_MS * (tb_conv.freq / 1000);
+}
+
+// primary side, after starting a secondary that calls ppc64_timebase_take()
+void ppc64_timebase_give(uint cpu) {
+  if (!(msr_read() & MSR_HV)) return;
+
+  uint64_t start = tbl_read();
+  while (tb_handoff.state != TB_STATE(cpu, TB_READY)) {
+    if (tb_handoff_expired(start)) {
+      dprintf(INFO, "timebase handoff to cpu %u timed out\n", cpu);
+      // if it still turns up it finds no GO and gives up on its own
+      tb_handoff.state = TB_IDLE;
+      return;
+    }
+  }
+  tb_handoff.tb = tbl_read();
+  __asm__ volatile("lwsync" ::: "memory");
+  tb_handoff.state = TB_STATE(cpu, TB_GO);
+  while (tb_handoff.state != TB_IDLE)
+    ;
+}
+
+void ppc64_timebase_take(void) {
+  if (!(msr_read() & MSR_HV)) return;
+
+  uint cpu = arch_curr_cpu_num();
+  uint64_t start = tbl_read();
+  tb_handoff.state = TB_STATE(cpu, TB_READY);
+  while (tb_handoff.state != TB_STATE(cpu, TB_GO)) {
+    // take READY back unless the GO landed meanwhile, then run with the timebase we have
+    if (tb_handoff_expired(start) &&
+        atomic_cmpxchg(&tb_handoff.state, TB_STATE(cpu, TB_READY), TB_IDLE) != TB_STATE(cpu, TB_GO)) {
+      return;
+    }
+  }
+  __asm__ volatile("lwsync" ::: "memory");
+  uint64_t tb = tb_handoff.tb;
+  // zero the low half first so it cant carry into the new upper half
+  tbl_write(0);
+  tbu_write(tb >> 32);
+  tbl_write(tb & 0xffffffff);
+  tb_handoff.state = TB_IDLE;
+}
+
+static void dec_program(uint64_t deadline, uint64_t now) {
+  uint64_t max = dec_sample_period ? dec_sample_period : DEC_MAX;
+  uint64_t delta = deadline > now ? deadline - now : 0;
+  dec_write(delta > max ? max : delta);
+}
+
+// applies to every cpu, each picks it up at its next DEC write or ppc64_timer_rearm()
+void ppc64_timer_set_sample_period(uint64_t ticks) {
+  dec_sample_period = ticks > DEC_MAX ? DEC_MAX : ticks;
+}
+
+void ppc64_timer_rearm(void) {
+  dec_program(oneshot[arch_curr_cpu_num()].deadline, tbl_read());
 }
 
 status_t platform_set_oneshot_timer (platform_timer_callback callback, void *arg, lk_time_t interval) {
-  printf("setting timer for %d ms\n", interval);
+  struct oneshot *t = &oneshot[arch_curr_cpu_num()];
+  uint64_t now = tbl_read();
+
+  // round up to the next ms boundary of the timebase, deadlines landing in the same ms coalesce
+  // into one decrementer interrupt, and re-arming for the same ms costs no mtspr
+  uint64_t deadline = tb_from_ms(tb_scale(now, tb_conv.ms_mult) + interval + 1);
+
+  t->callback = callback;
+  t->arg = arg;
+  if (deadline == t->deadline) return NO_ERROR;
+
+  t->deadline = deadline;
+  dec_program(deadline, now);
   return NO_ERROR;
 }
 
 void platform_stop_timer(void) {
+  struct oneshot *t = &oneshot[arch_curr_cpu_num()];
+  t->deadline = DEADLINE_NONE;
+  dec_program(DEADLINE_NONE, 0);
 }
+
+enum handler_return ppc64_decrementer_irq(void) {
+  struct oneshot *t = &oneshot[arch_curr_cpu_num()];
+  uint64_t now = tbl_read();
+
+  if (t->deadline == DEADLINE_NONE || t->callback == NULL) {
+    dec_program(DEADLINE_NONE, now);
+    return INT_NO_RESCHEDULE;
+  }
+  if (now < t->deadline) {
+    // an intermediate hop of a deadline beyond DEC_MAX
+    dec_program(t->deadline, now);
+    return INT_NO_RESCHEDULE;
+  }
+
+  // disarm first, the callback usually re-arms for the next queue head
+  t->deadline = DEADLINE_NONE;
+  dec_program(DEADLINE_NONE, now);
+  return t->callback(t->arg, current_time());
+}
+
+static void timer_init_percpu(uint level) {
+  oneshot[arch_curr_cpu_num()].deadline = DEADLINE_NONE;
+}
+
+LK_INIT_HOOK_FLAGS(ppc64_timer, timer_init_percpu, LK_INIT_LEVEL_ARCH_EARLY, LK_INIT_FLAG_ALL_CPUS);
@@ -0,0 +1,132 @@
+#include <arch/atomic.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <arch/tlb.h>
+#include <kernel/mp.h>
+#include <kernel/spinlock.h>
+#include <lk/console_cmd.h>
+#include <lk/trace.h>
+#include <stdio.h>
+
+#define LOCAL_TRACE 0
+
+// TLB invalidation
+// tlbie is broadcast by the hardware, but the 970 and POWER4/5 take only one at a time across
+// the whole system, so every broadcast goes under tlbie_lock and pays for a tlbsync
+// tlbiel only touches the issuing cpu and needs neither, a gather that only concerns some
+// cpus is sent to them by ipi and each one tlbiels its own copy
+
+static spin_lock_t tlbie_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static struct {
+  uint64_t broadcasts;
+  uint64_t local;
+  uint64_t shootdowns;
+  uint64_t pages;
+} tlb_stats;
+
+static void tlbie_batch(const uint64_t *rb, uint count) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&tlbie_lock, state);
+  // ptesync orders the HPTE stores before the invalidations, tlbsync waits for the other cpus
+  __asm__ volatile("ptesync" ::: "memory");
+  for (uint i = 0; i < count; i++) {
+    if (rb[i] & PPC64_TLB_RB_LARGE) {
+      __asm__ volatile("tlbie %0, 1" :: "r"(rb[i]) : "memory");
+    } else {
+      __asm__ volatile("tlbie %0, 0" :: "r"(rb[i]) : "memory");
+    }
+  }
+  __asm__ volatile("eieio\n tlbsync\n ptesync" ::: "memory");
+  tlb_stats.broadcasts++;
+  spin_unlock_irqrestore(&tlbie_lock, state);
+}
+
+static void tlbiel_batch(const uint64_t *rb, uint count) {
+  __asm__ volatile("ptesync" ::: "memory");
+  for (uint i = 0; i < count; i++) {
+    if (rb[i] & PPC64_TLB_RB_LARGE) {
+      __asm__ volatile("tlbiel %0, 1" :: "r"(rb[i]) : "memory");
+    } else {
+      __asm__ volatile("tlbiel %0, 0" :: "r"(rb[i]) : "memory");
+    }
+  }
+  __asm__ volatile("ptesync" ::: "memory");
+}
+
+void ppc64_tlb_invalidate(uint64_t rb) {
+  tlbie_batch(&rb, 1);
+}
+
+#if WITH_SMP
+// one shootdown in flight, the initiator holds the lock until every target acked
+static spin_lock_t shootdown_lock = SPIN_LOCK_INITIAL_VALUE;
+static const struct ppc64_tlb_gather *shootdown_gather;
+static volatile int shootdown_pending;
+
+void ppc64_tlb_shootdown_irq(void) {
+  uint bit = 1U << arch_curr_cpu_num();
+  if (!(shootdown_pending & bit)) return;
+  __asm__ volatile("lwsync" ::: "memory");
+
+  tlbiel_batch(shootdown_gather->rb, shootdown_gather->count);
+  atomic_and(&shootdown_pending, ~bit);
+}
+
+static void tlb_shootdown(const struct ppc64_tlb_gather *g, uint targets) {
+  // a cpu waiting here may be the target of the shootdown in flight, keep serving it
+  while (spin_trylock(&shootdown_lock)) ppc64_tlb_shootdown_irq();
+
+  shootdown_gather = g;
+  __asm__ volatile("lwsync" ::: "memory");
+  shootdown_pending = targets;
+  ppc64_mp_send_arch_ipi(targets, PPC64_IPI_TLB);
+  tlbiel_batch(g->rb, g->count);
+  ppc64_smt_priority_low();
+  while (shootdown_pending);
+  ppc64_smt_priority_medium();
+
+  tlb_stats.shootdowns++;
+  spin_unlock(&shootdown_lock);
+}
+#else
+void ppc64_tlb_shootdown_irq(void) {
+}
+#endif
+
+void ppc64_tlb_gather_flush(struct ppc64_tlb_gather *g) {
+  if (!g->count) return;
+  LTRACEF("%u pages, cpus 0x%x\n", g->count, g->cpu_mask);
+
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  tlb_stats.pages += g->count;
+#if WITH_SMP
+  uint self = 1U << arch_curr_cpu_num();
+  uint others = g->cpu_mask & mp.active_cpus & ~self;
+  uint all_others = mp.active_cpus & ~self;
+  if (!others) {
+    tlbiel_batch(g->rb, g->count);
+    tlb_stats.local++;
+  } else if (others == all_others) {
+    tlbie_batch(g->rb, g->count);
+  } else {
+    tlb_shootdown(g, others);
+  }
+#else
+  tlbiel_batch(g->rb, g->count);
+  tlb_stats.local++;
+#endif
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+  g->count = 0;
+}
+
+static int cmd_tlb(int argc, const console_cmd_args *argv) {
+  printf("%llu pages invalidated: %llu local batches, %llu broadcasts, %llu shootdowns\n",
+      tlb_stats.pages, tlb_stats.local, tlb_stats.broadcasts, tlb_stats.shootdowns);
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("tlb", "tlb invalidation stats", &cmd_tlb)
+STATIC_COMMAND_END(tlb);
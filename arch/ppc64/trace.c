@@ -0,0 +1,196 @@
+#include <arch/cpu_regs.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <kernel/thread.h>
+#include <lk/compiler.h>
+#include <lk/console_cmd.h>
+#include <lk/err.h>
+#include <stdio.h>
+#include <string.h>
+
+// function entry/exit tracer for code built with -finstrument-functions, see TRACE_FUNCTIONS in rules.mk
+// every hook writes one timebase stamped record into this cpu's ring, the slot is claimed with a
+// lwarx/stwcx. increment so an interrupt landing inside a hook just takes the next slot
+// `trace dump` prints the rings, scripts/trace.sh turns them into folded stacks for flame graphs
+
+#if WITH_TRACE_FUNCTIONS
+
+#ifndef __NO_INSTRUMENT
+#define __NO_INSTRUMENT __attribute__((no_instrument_function))
+#endif
+
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 8192 // per cpu, power of two
+#endif
+
+// kind, in the low bits of the address, functions and threads are at least 4 byte aligned
+#define TRACE_ENTER  0
+#define TRACE_EXIT   1
+#define TRACE_SWITCH 2
+#define TRACE_NAME   3 // the slot after a switch, the thread's name in tb and addr
+#define TRACE_KIND   3
+#define TRACE_NAME_LEN 15
+
+struct trace_record {
+  uint64_t tb;
+  uint64_t addr;
+};
+
+struct trace_cpu {
+  uint32_t head; // records claimed since the last reset, the ring keeps the newest TRACE_RECORDS
+  struct trace_record ring[TRACE_RECORDS];
+} __ALIGNED(CACHE_LINE);
+
+// in .data, the hooks already run before clear_bss. the rings only need to be when tracing from
+// boot, and they make the image TRACE_RECORDS * 16 bytes per cpu bigger
+#if TRACE_FUNCTIONS_BOOT
+static struct trace_cpu trace_cpu[SMP_MAX_CPUS] __SECTION(".data");
+static volatile int trace_on __SECTION(".data") = 1;
+static volatile int trace_stop_when_full __SECTION(".data") = 1;
+#else
+static struct trace_cpu trace_cpu[SMP_MAX_CPUS];
+static volatile int trace_on __SECTION(".data") = 0;
+static volatile int trace_stop_when_full __SECTION(".data") = 0;
+#endif
+
+static inline __NO_INSTRUMENT struct trace_cpu *trace_claim(uint32_t slots, uint32_t *slot) {
+  if (!trace_on) return NULL;
+
+  uint cpu = arch_curr_cpu_num();
+  if (cpu >= SMP_MAX_CPUS) return NULL;
+
+  struct trace_cpu *c = &trace_cpu[cpu];
+  *slot = __atomic_fetch_add(&c->head, slots, __ATOMIC_RELAXED);
+  if (*slot >= TRACE_RECORDS && trace_stop_when_full) return NULL;
+  return c;
+}
+
+static inline __NO_INSTRUMENT void trace_put(uint64_t addr) {
+  uint64_t tb = tbl_read();
+  uint32_t slot;
+  struct trace_cpu *c = trace_claim(1, &slot);
+  if (!c) return;
+
+  struct trace_record *r = &c->ring[slot & (TRACE_RECORDS - 1)];
+  r->tb = tb;
+  r->addr = addr;
+}
+
+void __NO_INSTRUMENT __cyg_profile_func_enter(void *fn, void *call_site) {
+  trace_put((uint64_t)fn | TRACE_ENTER);
+}
+
+void __NO_INSTRUMENT __cyg_profile_func_exit(void *fn, void *call_site) {
+  trace_put((uint64_t)fn | TRACE_EXIT);
+}
+
+// from arch_context_switch, later records on this cpu belong to the new thread
+// the name is copied now, the thread may be gone by the time of the dump
+// big endian, the kind lands in the last byte of the name slot
+void __NO_INSTRUMENT ppc64_trace_switch(struct thread *newthread) {
+  uint64_t tb = tbl_read();
+  uint32_t slot;
+  struct trace_cpu *c = trace_claim(2, &slot);
+  if (!c) return;
+
+  struct trace_record *r = &c->ring[slot & (TRACE_RECORDS - 1)];
+  r->tb = tb;
+  r->addr = (uint64_t)newthread | TRACE_SWITCH;
+  if (slot + 1 >= TRACE_RECORDS && trace_stop_when_full) return;
+
+  // by hand, an instrumented strncpy would trace itself from inside the switch
+  char name[TRACE_NAME_LEN + 1];
+  bool end = false;
+  for (uint i = 0; i < TRACE_NAME_LEN; i++) {
+    end |= newthread->name[i] == '\0';
+    name[i] = end ? '\0' : newthread->name[i];
+  }
+  name[TRACE_NAME_LEN] = TRACE_NAME;
+  r = &c->ring[(slot + 1) & (TRACE_RECORDS - 1)];
+  memcpy(r, name, sizeof(*r));
+}
+
+static void trace_reset(bool stop_when_full) {
+  trace_on = 0;
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+    trace_cpu[cpu].head = 0;
+  }
+  trace_stop_when_full = stop_when_full;
+  __asm__ volatile("sync" ::: "memory");
+}
+
+static void trace_dump_cpu(uint cpu) {
+  struct trace_cpu *c = &trace_cpu[cpu];
+  uint32_t head = c->head;
+  uint32_t count = head < TRACE_RECORDS ? head : TRACE_RECORDS;
+  // stop when full keeps the oldest records, wrapping keeps the newest
+  uint32_t first = (head > TRACE_RECORDS && !trace_stop_when_full) ? head - TRACE_RECORDS : 0;
+
+  printf("cpu %u records %u lost %u\n", cpu, count, head - count);
+  for (uint32_t i = 0; i < count; i++) {
+    const struct trace_record *r = &c->ring[(first + i) & (TRACE_RECORDS - 1)];
+    uint64_t addr = r->addr & ~(uint64_t)TRACE_KIND;
+    switch (r->addr & TRACE_KIND) {
+      case TRACE_ENTER:
+        printf("e %llx %llx\n", r->tb, addr);
+        break;
+      case TRACE_EXIT:
+        printf("x %llx %llx\n", r->tb, addr);
+        break;
+      case TRACE_SWITCH: {
+        // the name slot is missing when the ring filled up or wrapped right here
+        const struct trace_record *n = &c->ring[(first + i + 1) & (TRACE_RECORDS - 1)];
+        if (i + 1 < count && (n->addr & TRACE_KIND) == TRACE_NAME) {
+          printf("s %llx %llx %.*s\n", r->tb, addr, TRACE_NAME_LEN, (const char *)n);
+          i++;
+        } else {
+          printf("s %llx %llx ?\n", r->tb, addr);
+        }
+        break;
+      }
+      case TRACE_NAME:
+        // its switch record was overwritten
+        break;
+    }
+  }
+}
+
+static int cmd_trace(int argc, const console_cmd_args *argv) {
+  if (argc < 2) {
+    printf("tracing %s, %s, %u records per cpu\n", trace_on ? "on" : "off",
+        trace_stop_when_full ? "stop when full" : "wrapping", TRACE_RECORDS);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+      printf("cpu %u: %u records\n", cpu, trace_cpu[cpu].head);
+    }
+    printf("usage: %s start [full] | stop | dump [cpu]\n", argv[0].str);
+    printf("  full keeps the first records instead of wrapping, feed dumps to scripts/trace.sh\n");
+    return 0;
+  }
+
+  if (!strcmp(argv[1].str, "start")) {
+    trace_reset(argc >= 3 && !strcmp(argv[2].str, "full"));
+    trace_on = 1;
+  } else if (!strcmp(argv[1].str, "stop")) {
+    trace_on = 0;
+  } else if (!strcmp(argv[1].str, "dump")) {
+    // printing would trace itself, and racing writers could tear records
+    trace_on = 0;
+    __asm__ volatile("sync" ::: "memory");
+    printf("trace: begin tbfreq %llu\n", ppc64_timebase_freq());
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+      if (argc >= 3 && cpu != argv[2].u) continue;
+      trace_dump_cpu(cpu);
+    }
+    printf("trace: end\n");
+  } else {
+    printf("unknown subcommand\n");
+    return ERR_INVALID_ARGS;
+  }
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("trace", "function entry tracer", &cmd_trace)
+STATIC_COMMAND_END(trace);
+
+#endif
@@ -0,0 +1,117 @@
+#include <arch/ppc64.h>
+#include <kernel/spinlock.h>
+#include <kernel/vm.h>
+#include <lk/console_cmd.h>
+#include <lk/init.h>
+#include <lk/trace.h>
+#include <stdio.h>
+
+#define LOCAL_TRACE 0
+
+// physical pages zeroed ahead of time
+// pages are taken from the pmm in batches from thread context (dirty), the idle thread of any
+// cpu zeroes them a page at a time with dcbz (clean), and a PPC64_PMM_ALLOC_FLAG_ZEROED
+// allocation pops a clean page or, when there are none, zeroes one in place
+// the idle thread never takes the pmm mutex, it only moves pages between the two lists
+
+#define POOL_TARGET 64           // dirty + clean, 256K
+#define POOL_LOW (POOL_TARGET / 4)
+
+static struct list_node dirty = LIST_INITIAL_VALUE(dirty);
+static struct list_node clean = LIST_INITIAL_VALUE(clean);
+static uint dirty_count, clean_count, zeroing;
+static spin_lock_t pool_lock = SPIN_LOCK_INITIAL_VALUE;
+
+static struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t zeroed;
+} pool_stats;
+
+static void pool_zero(vm_page_t *p) {
+  ppc64_cache_zero_range(paddr_to_kvaddr(vm_page_to_paddr(p)), PAGE_SIZE);
+}
+
+// thread context, the pmm may block
+// two racing fills may overshoot the target by a batch, which does no harm
+static void pool_fill(void) {
+  uint have = dirty_count + clean_count + zeroing;
+  if (have >= POOL_TARGET) return;
+  uint want = POOL_TARGET - have;
+
+  struct list_node pages = LIST_INITIAL_VALUE(pages);
+  size_t got = pmm_alloc_pages(want, &pages);
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&pool_lock, state);
+  vm_page_t *p;
+  while ((p = list_remove_head_type(&pages, vm_page_t, node))) list_add_tail(&dirty, &p->node);
+  dirty_count += got;
+  spin_unlock_irqrestore(&pool_lock, state);
+
+  LTRACEF("%zu pages in\n", got);
+}
+
+vm_page_t *ppc64_pmm_alloc_page(uint flags) {
+  if (!(flags & PPC64_PMM_ALLOC_FLAG_ZEROED)) return pmm_alloc_page();
+
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&pool_lock, state);
+  vm_page_t *p = list_remove_head_type(&clean, vm_page_t, node);
+  if (p) {
+    clean_count--;
+    pool_stats.hits++;
+  } else {
+    pool_stats.misses++;
+  }
+  bool low = dirty_count + clean_count < POOL_LOW;
+  spin_unlock_irqrestore(&pool_lock, state);
+
+  if (!p) {
+    p = pmm_alloc_page();
+    if (p) pool_zero(p);
+  }
+  if (low) pool_fill();
+  return p;
+}
+
+// from arch_idle() with interrupts on, one page per call so a wakeup waits for 4K at most
+// returns false when there was nothing to zero
+bool ppc64_zero_pool_idle(void) {
+  spin_lock_saved_state_t state;
+  spin_lock_irqsave(&pool_lock, state);
+  vm_page_t *p = list_remove_head_type(&dirty, vm_page_t, node);
+  if (p) {
+    dirty_count--;
+    zeroing++;
+  }
+  spin_unlock_irqrestore(&pool_lock, state);
+  if (!p) return false;
+
+  pool_zero(p);
+
+  spin_lock_irqsave(&pool_lock, state);
+  list_add_tail(&clean, &p->node);
+  zeroing--;
+  clean_count++;
+  pool_stats.zeroed++;
+  spin_unlock_irqrestore(&pool_lock, state);
+  return true;
+}
+
+static void zero_pool_init(uint level) {
+  pool_fill();
+}
+
+LK_INIT_HOOK(ppc64_zero_pool, zero_pool_init, LK_INIT_LEVEL_VM);
+
+static int cmd_zeropool(int argc, const console_cmd_args *argv) {
+  printf("%u clean, %u dirty of %u\n", clean_count, dirty_count, POOL_TARGET);
+  printf("%llu hits, %llu misses zeroed in place, %llu zeroed from idle\n", pool_stats.hits,
+      pool_stats.misses, pool_stats.zeroed);
+  return 0;
+}
+
+STATIC_COMMAND_START
+STATIC_COMMAND("zeropool", "pre-zeroed page pool", &cmd_zeropool)
+STATIC_COMMAND_END(zeropool);
@@ -3,12 +3,15 @@
 #include <lib/cbuf.h>
 #include <lib/io.h>
 #include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/init.h>
 #include <lk/reg.h>
 #include <platform/debug.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <arch/hypercalls.h>
+#include <arch/ppc64.h>
 
 //#define UART_DR 0x3f8
 #define UART_DR (0xe0000000ULL + 0x4500ULL + 0)
@@ -16,11 +19,12 @@
 #if WITH_KERNEL_VM
 #include <kernel/vm.h>
 
+// the large page linear map, reserved whole so the vmm puts 4K regions in segments above it
 struct mmu_initial_mapping mmu_initial_mappings[] = {
   {
     .phys = 16<<20,
     .virt = 16<<20,
-    .size = 2<<20,
+    .size = MEMBASE + MEMSIZE - (16<<20),
     .flags = 0,
     .name = "memory",
   },
@@ -33,6 +37,12 @@ static pmm_arena_t arena = {
     .size = 16 << 20,
     .flags = PMM_ARENA_FLAG_KMAP,
 };
+
+// with a device tree
+#define BUDDY_SIZE (64 << 20)
+static pmm_arena_t fdt_arenas[PPC64_FDT_MEM_MAX + 1];
+static uint fdt_arena_count;
+static struct list_node fdt_reserved = LIST_INITIAL_VALUE(fdt_reserved);
 #endif
 
 static int cmd_p(int argc, const console_cmd_args *argv);
@@ -43,8 +53,169 @@ STATIC_COMMAND("p", "", &cmd_p)
 STATIC_COMMAND("x", "", &cmd_x)
 STATIC_COMMAND_END(platform);
 
+#if WITH_KERNEL_VM
+static void fdt_add_arena(paddr_t base, paddr_t end, uint priority) {
+  if (end <= base) return;
+  pmm_arena_t *a = &fdt_arenas[fdt_arena_count++];
+  a->name = priority ? "ram" : "rma";
+  a->base = base;
+  a->size = end - base;
+  a->priority = priority;
+  a->flags = PMM_ARENA_FLAG_KMAP;
+  pmm_add_arena(a);
+}
+
+static bool fdt_overlaps(const struct ppc64_fdt_info *fdt, paddr_t base, paddr_t end) {
+  if (base < fdt->blob + fdt->blob_size && fdt->blob < end) return true;
+  for (uint i = 0; i < fdt->rsv_count; i++) {
+    if (base < fdt->rsv[i].base + fdt->rsv[i].size && fdt->rsv[i].base < end) return true;
+  }
+  return false;
+}
+
+// every memory node from 16M up to the linear map limit becomes an arena. the one at 0 is the
+// RMA, the only RAM real mode reaches under an LPAR, exceptions run in real mode on thread stacks
+// and walk page tables, so it goes ahead of the rest and the heap only spills over when it is full
+// the arenas' vm_page arrays are boot allocated right after the kernel, the buddy allocator gets
+// BUDDY_SIZE of the RMA from the next 16MB past them, left out of the arenas
+static bool fdt_memory_init(void) {
+  extern uint8_t _end;
+  const struct ppc64_fdt_info *fdt = ppc64_fdt();
+  if (!fdt || !fdt->mem_count) return false;
+
+  paddr_t lo[PPC64_FDT_MEM_MAX], hi[PPC64_FDT_MEM_MAX];
+  paddr_t ram_end = 0, rma_end = 0;
+  size_t pages = 0;
+  for (uint i = 0; i < fdt->mem_count; i++) {
+    uint64_t end = fdt->mem[i].base + fdt->mem[i].size;
+    lo[i] = ROUNDUP(fdt->mem[i].base > (16 << 20) ? fdt->mem[i].base : (16 << 20), PAGE_SIZE);
+    hi[i] = ROUNDDOWN(end < PPC64_LINEAR_MAX ? end : PPC64_LINEAR_MAX, PAGE_SIZE);
+    if (hi[i] <= lo[i]) continue;
+    pages += (hi[i] - lo[i]) / PAGE_SIZE;
+    if (hi[i] > ram_end) ram_end = hi[i];
+    if (fdt->mem[i].base == 0) rma_end = hi[i];
+  }
+  if (!ram_end) return false;
+
+  paddr_t window = (paddr_t)&_end + pages * sizeof(vm_page_t) + countof(fdt_arenas) * PAGE_SIZE;
+  window = ROUNDUP(window, 16 << 20);
+  if (window + BUDDY_SIZE > rma_end || fdt_overlaps(fdt, window, window + BUDDY_SIZE)) window = 0;
+
+  for (uint i = 0; i < fdt->mem_count; i++) {
+    uint priority = fdt->mem[i].base ? 1 : 0;
+    if (window && window >= lo[i] && window + BUDDY_SIZE <= hi[i]) {
+      fdt_add_arena(lo[i], window, priority);
+      fdt_add_arena(window + BUDDY_SIZE, hi[i], priority);
+    } else {
+      fdt_add_arena(lo[i], hi[i], priority);
+    }
+  }
+
+  // the tree itself and whatever the loader reserved, RTAS among them, stay allocated
+  pmm_alloc_range(ROUNDDOWN(fdt->blob, PAGE_SIZE),
+      (ROUNDUP(fdt->blob + fdt->blob_size, PAGE_SIZE) - ROUNDDOWN(fdt->blob, PAGE_SIZE)) / PAGE_SIZE,
+      &fdt_reserved);
+  for (uint i = 0; i < fdt->rsv_count; i++) {
+    paddr_t base = ROUNDDOWN(fdt->rsv[i].base, PAGE_SIZE);
+    pmm_alloc_range(base, (ROUNDUP(fdt->rsv[i].base + fdt->rsv[i].size, PAGE_SIZE) - base) / PAGE_SIZE,
+        &fdt_reserved);
+  }
+
+  mmu_initial_mappings[0].size = ram_end - (16 << 20);
+  if (window) ppc64_buddy_add_arena(window, BUDDY_SIZE);
+  return true;
+}
+#endif
+
 void platform_early_init(void) {
+#if WITH_KERNEL_VM
+  if (fdt_memory_init()) return;
+#endif
   pmm_add_arena(&arena);
+  // RAM past the pmm arena up to MEMBASE is nobody's, the loader's device tree sits near the top
+  ppc64_buddy_add_arena(arena.base + arena.size, MEMBASE - (arena.base + arena.size));
+}
+
+#if WITH_SMP
+// qemu hands out fixed tokens (RTAS_TOKEN_BASE + n), the /rtas node in the DT lists the same values
+#define RTAS_START_CPU 0x2007
+
+struct rtas_args {
+  uint32_t token;
+  uint32_t nargs;
+  uint32_t nret;
+  uint32_t args[16]; // inputs, followed by outputs
+};
+
+// the cpu starts at entry in real mode with MSR.SF|MSR.ME, and r3 = arg
+static int32_t rtas_start_cpu(uint32_t cpu, uint64_t entry, uint64_t arg) {
+  const struct ppc64_fdt_info *fdt = ppc64_fdt();
+  struct rtas_args args = {
+    .token = fdt && fdt->rtas_start_cpu ? fdt->rtas_start_cpu : RTAS_START_CPU,
+    .nargs = 3,
+    .nret = 1,
+    .args = { cpu, entry, arg },
+  };
+  do_hypercall4(KVMPPC_H_RTAS, (uint64_t)&args, 0, 0, 0);
+  return args.args[3];
+}
+
+static void start_secondary_cpus(void) {
+  uint started = 0;
+  for (uint cpu = 1; cpu < ppc64_cpu_count(); cpu++) {
+    int32_t ret = rtas_start_cpu(cpu, (uint64_t)&_secondary_start, cpu);
+    if (ret != 0) {
+      // -3 when qemu was started with a smaller -smp
+      dprintf(INFO, "start-cpu %u failed: %d\n", cpu, ret);
+      continue;
+    }
+    ppc64_timebase_give(cpu);
+    started++;
+  }
+  dprintf(INFO, "started %u secondary cpus\n", started);
+}
+#endif
+
+// XICS in legacy mode, we never negotiate XIVE through client-architecture-support
+#define XICS_IPI 2 // per-server ipi source
+#define IPI_PRIORITY 4
+
+enum handler_return platform_irq(struct ppc64_iframe *frame) {
+  uint64_t out[4];
+  do_hypercall_ret4(H_XIRR, 0, 0, 0, 0, out);
+  uint32_t xirr = out[0];
+  uint32_t source = xirr & 0xffffff;
+  if (source == 0) return INT_NO_RESCHEDULE;
+
+  enum handler_return ret = INT_NO_RESCHEDULE;
+#if WITH_SMP
+  if (source == XICS_IPI) {
+    // drop our MFRR back to least favored first, or the ipi fires again after the EOI
+    do_hypercall4(H_IPI, arch_curr_cpu_num(), 0xff, 0, 0);
+    ret = ppc64_mp_ipi_irq();
+  }
+#endif
+  do_hypercall4(H_EOI, xirr, 0, 0, 0);
+  return ret;
+}
+
+#if WITH_SMP
+void platform_send_ipi(uint cpu) {
+  do_hypercall4(H_IPI, cpu, IPI_PRIORITY, 0, 0);
+}
+#endif
+
+static void xics_init_percpu(uint level) {
+  // the presentation controller starts at CPPR 0, which masks everything
+  do_hypercall4(H_CPPR, 0xff, 0, 0, 0);
+}
+
+LK_INIT_HOOK_FLAGS(xics, xics_init_percpu, LK_INIT_LEVEL_PLATFORM_EARLY, LK_INIT_FLAG_ALL_CPUS);
+
+void platform_init(void) {
+#if WITH_SMP
+  start_secondary_cpus();
+#endif
 }
 
 static int cmd_p(int argc, const console_cmd_args *argv) {
@@ -65,70 +236,11 @@ static int cmd_p(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
-typedef struct {
-  uint64_t pte0, pte1;
-} pte_t;
-
-typedef struct {
-  pte_t e[8];
-} pteg_t;
-
-static void map_page(uint64_t vpn, uint64_t physical) {
-  uint64_t avpn = vpn >> 11;
-  uint64_t pte0 = (avpn << 7) | 1;
-  uint64_t pte1 = physical | 0x10 | 2;
-  uint64_t hash = vpn; // TODO, masking
-#if 0
-  pteg_t *p = page_table;
-  p[hash].e[0].pte0 = pte0;
-  p[hash].e[0].pte1 = pte1;
-#else
-  puts("hentering");
-  uint64_t ret = h_enter(0, (0&7) | (hash << 3), pte0, pte1);
-  printf("ret 0x%llx\n", ret);
-#endif
-  printf("PTE[0x%llx] = 0x%llx 0x%llx\n", hash, pte0, pte1);
-}
-
-#if 0
-void mmu_setup(void) {
-  void *page_table = memalign(256<<10, 256<<10);
-  memset(page_table, 0, 256<<10);
-  printf("%p\n", page_table);
-  sdr1_write(page_table);
-}
-#else
-void mmu_setup(void) {
-}
-#endif
-
-extern uint8_t _start, _end;
-
 static int cmd_x(int argc, const console_cmd_args *argv) {
-  mmu_setup();
-
-  uint64_t virt_start = (uint64_t)&_start;
-  uint64_t virt_end = ROUNDUP((uint64_t)&_end, 4096);
-  uint64_t phys_start = 16 << 20;
-
-  virt_end += 1<<20; // since activating late, the heap has grown
-
-  printf("mapping 0x%llx to 0x%llx->0x%llx\n", phys_start, virt_start, virt_end);
-  printf("vpn range 0x%llx -> 0x%llx\n", virt_start>>12, virt_end >> 12);
-
-  for (uint64_t vpn = virt_start >> 12; vpn < (virt_end>>12); vpn++) {
-    map_page(vpn, vpn << 12);
-  }
-
-  slbmte(0, 1, 1, 0, 0, 0, 0, 1, 0);
-
+  // RAM is in the bolted linear map, entered through the hypervisor, and the SLB miss
+  // handler covers the segments, so translation only needs switching on. it is per thread, the
+  // shell and threads it creates from here on run translated
   msr_write(1ULL<<63 | 1ULL<<4 | 1ULL<<5);
-
-  //while (true) {
-  //}
-
-  //sdr1_write(0);
-  //free(page_table);
   return 0;
 }
 
@@ -170,12 +282,6 @@ void hyper_serial_rx_loop(const struct app_descriptor *, void *) {
   }
 }
 
-// TODO, H_CEDE for arch_idle?
-// also, bit 45/18, MSR_POW, can trigger sleep
-// SPR_HID0 can contain a deepnap/doze/nap flag
-// see check_pow_970
-
-
 APP_START(platform_rx)
   .entry = hyper_serial_rx_loop,
 APP_END
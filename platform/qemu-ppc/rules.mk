@@ -5,7 +5,7 @@ MODULE := $(LOCAL_DIR)
 MEMBASE := 0x10000000
 MEMSIZE := 0x10000000
 
-GLOBAL_DEFINES += SMP_MAX_CPUS=6
+GLOBAL_DEFINES += SMP_MAX_CPUS=6 WITH_SMP=1
 GLOBAL_DEFINES += MEMBASE=$(MEMBASE) MEMSIZE=$(MEMSIZE)
 GLOBAL_DEFINES += CONSOLE_HAS_INPUT_BUFFER=1
 
@@ -6,6 +6,7 @@
 #include <lk/reg.h>
 #include <platform.h>
 #include <arch/ops.h>
+#include <arch/ppc64.h>
 #include <platform/debug.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -186,8 +187,12 @@ struct ati_info {
 
 void fb_init(void) {
   uint32_t size = WIDTH * HEIGHT * 4;
-  framebuffer = malloc(size);
-  bzero(framebuffer, size);
+  // 3.5MB, only the rows something draws to get pages, a retile of the rest reads the zero page
+  framebuffer = ppc64_lazy_alloc(size, 0);
+  if (!framebuffer) {
+    framebuffer = malloc(size);
+    bzero(framebuffer, size);
+  }
   printf("allocated fb to %p\n", framebuffer);
   struct ati_info *ai = (struct ati_info*)0xec806100ULL;
   printf("base: 0x%x\n", ai->base);
@@ -286,58 +291,13 @@ static int cmd_p(int argc, const console_cmd_args *argv) {
   return 0;
 }
 
-uint64_t *page_table;
-
-void mmu_setup(void) {
-  page_table = memalign(256<<10, 256<<10);
-  memset(page_table, 0, 256<<10);
-  printf("%p\n", page_table);
-  sdr1_write((uint64_t)page_table);
-}
-
-typedef struct {
-  uint64_t pte0, pte1;
-} pte_t;
-
-typedef struct {
-  pte_t e[8];
-} pteg_t;
-
-static void map_page(uint64_t vpn, uint64_t physical) {
-  uint64_t avpn = vpn >> 11;
-  uint64_t pte0 = (avpn << 7) | 1;
-  uint64_t pte1 = physical | 0x10 | 2;
-  uint64_t addr_upper = 1; // TODO
-  uint64_t hash = (vpn ^ addr_upper) & 0x7ff;
-  pteg_t *p = (pteg_t*)page_table;
-  p[hash].e[0].pte0 = pte0;
-  p[hash].e[0].pte1 = pte1;
-  printf("mapping virt 0x%x -> phys 0x%x\n", (uint32_t)(vpn << 12), (uint32_t)physical);
-  printf("PTE[0x%llx] = 0x%llx 0x%llx\n", hash, pte0, pte1);
-}
-
-extern uint8_t _start, _end;
-
 static int cmd_x(int argc, const console_cmd_args *argv) {
-  mmu_setup();
-
-  uint64_t virt_start = ROUNDDOWN((uint64_t)&_start, 4096);
-  uint64_t virt_end = ROUNDUP((uint64_t)&_end, 4096);
-  uint64_t phys_start = virt_start;
-  virt_end += 1<<20; // since activating late, the heap has grown, TODO improve
-  printf("mapping 0x%llx to 0x%llx->0x%llx\n", phys_start, virt_start, virt_end);
-  printf("vpn range 0x%llx -> 0x%llx\n", virt_start>>12, virt_end >> 12);
-  for (uint64_t vpn = virt_start >> 12; vpn < (virt_end>>12); vpn++) {
-    map_page(vpn, vpn << 12);
-  }
-
+  // RAM is in the bolted linear map and its segments are bolted in the SLB, the rest
+  // comes in through the segment miss handler
   uint64_t lpcr = lpcr_read();
   lpcr &= ~0x400; // clear SW TLB bit
   lpcr_write(lpcr);
 
-  const uint64_t vsid = 256 >> 8; // TODO
-  const uint64_t esid = 1; // TODO
-  slbmte(vsid, 1, 1, 0, 0, 0, esid, 1, 0);
   msr_write(1ULL<<63 | 1ULL<<60 | 1ULL<<4 | 1ULL<<5);
   return 0;
 }
@@ -0,0 +1,80 @@
+#!/bin/sh
+# symbolize the output of the `profile dump` (or `profile run`) shell command
+#
+# usage: scripts/profile.sh <console log> [lk.elf]
+#   the log may hold anything else, only the last begin/end block is used
+#   lk.elf defaults to build-qemu-ppc64/lk.elf, the nm used is ${TOOLCHAIN_PREFIX}nm,
+#   TOOLCHAIN_PREFIX defaulting to the one in arch/ppc64/rules.mk
+#
+# prints a flat profile by function, then the caller -> callee pairs from the sampled lr
+
+set -e
+
+LOG=$1
+ELF=${2:-build-qemu-ppc64/lk.elf}
+# the same toolchain the arch builds with unless overridden
+RULES_PREFIX=$(sed -n 's/^TOOLCHAIN_PREFIX *:= *//p' "$(dirname "$0")/../arch/ppc64/rules.mk")
+NM=${TOOLCHAIN_PREFIX:-$RULES_PREFIX}nm
+TOP=${TOP:-40}
+
+if [ -z "$LOG" ] || [ ! -f "$LOG" ] || [ ! -f "$ELF" ]; then
+  echo "usage: $0 <console log> [lk.elf]" >&2
+  exit 1
+fi
+
+# text symbols sorted by address, elfv1 dot symbols lose the dot
+$NM -n --defined-only "$ELF" | awk '$2 ~ /^[tTwW]$/ { sub(/^\./, "", $3); print $1, $3 }' > /tmp/profile.syms.$$
+trap 'rm -f /tmp/profile.syms.$$' EXIT
+
+tr -d '\r' < "$LOG" | awk -v top="$TOP" -v syms=/tmp/profile.syms.$$ '
+function lookup(addr,    lo, hi, mid) {
+  lo = 1; hi = nsym
+  if (nsym == 0 || addr < sa[1]) return sprintf("0x%x", addr)
+  while (lo < hi) {
+    mid = int((lo + hi + 1) / 2)
+    if (sa[mid] <= addr) lo = mid; else hi = mid - 1
+  }
+  return sn[lo]
+}
+function hex(s,    v, i, c) {
+  s = tolower(s); sub(/^0x/, "", s); v = 0
+  for (i = 1; i <= length(s); i++) {
+    c = index("0123456789abcdef", substr(s, i, 1)) - 1
+    v = v * 16 + c
+  }
+  return v
+}
+function report(title, arr,    k, n, i, j, t, keys, vals) {
+  n = 0
+  for (k in arr) { n++; keys[n] = k; vals[n] = arr[k] }
+  # insertion sort by count, the tables are a few hundred entries at most
+  for (i = 2; i <= n; i++) {
+    for (j = i; j > 1 && vals[j] > vals[j - 1]; j--) {
+      t = vals[j]; vals[j] = vals[j - 1]; vals[j - 1] = t
+      t = keys[j]; keys[j] = keys[j - 1]; keys[j - 1] = t
+    }
+  }
+  printf("\n%s\n", title)
+  for (i = 1; i <= n && i <= top; i++)
+    printf("%8d %6.2f%%  %s\n", vals[i], 100 * vals[i] / total, keys[i])
+}
+BEGIN {
+  while ((getline line < syms) > 0) {
+    split(line, f, " ")
+    nsym++; sa[nsym] = hex(f[1]); sn[nsym] = f[2]
+  }
+}
+/profile: begin/ { inside = 1; delete flat; delete edges; delete threads; total = 0; header = $0; next }
+/profile: end/ { inside = 0; done = 1; next }
+!inside { next }
+$1 == "pc" { flat[lookup(hex($2))] += $3; total += $3 }
+$1 == "edge" { edges[lookup(hex($2)) " -> " lookup(hex($3))] += $4 }
+$1 == "thread" { threads[$3] += $4 }
+END {
+  if (!done || total == 0) { print "no complete profile block found" > "/dev/stderr"; exit 1 }
+  sub(/.*profile: /, "", header)
+  print header
+  report("flat profile", flat)
+  report("callers", edges)
+  report("threads", threads)
+}'
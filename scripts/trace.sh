@@ -0,0 +1,87 @@
+#!/bin/sh
+# decode the output of the `trace dump` shell command into folded stacks
+#
+# usage: scripts/trace.sh <console log> [lk.elf] > out.folded
+#   flamegraph.pl out.folded > out.svg, or load out.folded into speedscope
+#   lk.elf defaults to build-qemu-ppc64/lk.elf, the nm used is ${TOOLCHAIN_PREFIX}nm,
+#   TOOLCHAIN_PREFIX defaulting to the one in arch/ppc64/rules.mk
+#
+# each stack is cpu;thread;outer;...;inner weighted by timebase ticks of self time
+# calls already running when tracing started show up as exits without an entry and are dropped
+
+set -e
+
+LOG=$1
+ELF=${2:-build-qemu-ppc64/lk.elf}
+# the same toolchain the arch builds with unless overridden
+RULES_PREFIX=$(sed -n 's/^TOOLCHAIN_PREFIX *:= *//p' "$(dirname "$0")/../arch/ppc64/rules.mk")
+NM=${TOOLCHAIN_PREFIX:-$RULES_PREFIX}nm
+
+if [ -z "$LOG" ] || [ ! -f "$LOG" ] || [ ! -f "$ELF" ]; then
+  echo "usage: $0 <console log> [lk.elf]" >&2
+  exit 1
+fi
+
+SYMS=$(mktemp)
+trap 'rm -f "$SYMS"' EXIT
+$NM -n --defined-only "$ELF" | awk '$2 ~ /^[tTwW]$/ { sub(/^\./, "", $3); print $1, $3 }' > "$SYMS"
+
+tr -d '\r' < "$LOG" | awk -v syms="$SYMS" '
+function hex(s,    v, i) {
+  s = tolower(s); sub(/^0x/, "", s); v = 0
+  for (i = 1; i <= length(s); i++) v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+  return v
+}
+function lookup(a,    lo, hi, mid, addr) {
+  if (a in cache) return cache[a]
+  addr = hex(a); lo = 1; hi = nsym
+  if (nsym == 0 || addr < sa[1]) return cache[a] = "0x" a
+  while (lo < hi) {
+    mid = int((lo + hi + 1) / 2)
+    if (sa[mid] <= addr) lo = mid; else hi = mid - 1
+  }
+  return cache[a] = sn[lo]
+}
+function charge(tb,    key, i, d) {
+  if (last != "" && tb > last) {
+    key = "cpu" cpu ";" thr
+    d = depth[cpu, thr] + 0
+    for (i = 1; i <= d; i++) key = key ";" st[cpu, thr, i]
+    folded[key] += tb - last
+  }
+  last = tb
+}
+BEGIN {
+  while ((getline line < syms) > 0) {
+    split(line, f, " ")
+    nsym++; sa[nsym] = hex(f[1]); sn[nsym] = f[2]
+  }
+}
+/trace: begin/ { inside = 1; delete folded; delete depth; delete st; next }
+/trace: end/ { inside = 0; done = 1; next }
+!inside { next }
+$1 == "cpu" { cpu = $2; thr = "?"; last = ""; next }
+$1 == "e" {
+  charge(hex($2))
+  d = ++depth[cpu, thr]
+  st[cpu, thr, d] = lookup($3)
+  next
+}
+$1 == "x" {
+  charge(hex($2))
+  fn = lookup($3)
+  # unwind to the matching entry, a longjmp or an unmatched exit leaves frames behind
+  for (d = depth[cpu, thr] + 0; d > 0 && st[cpu, thr, d] != fn; d--)
+    ;
+  if (d > 0) depth[cpu, thr] = d - 1
+  next
+}
+$1 == "s" {
+  charge(hex($2))
+  thr = $4 "@" $3
+  next
+}
+END {
+  if (!done) { print "no complete trace block found" > "/dev/stderr"; exit 1 }
+  for (k in folded) print k, folded[k]
+}' | sort
@@ -0,0 +1,47 @@
+#include <lib/unittest.h>
+
+#include <arch/defines.h>
+#include <arch/ppc64.h>
+#include <lk/compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+extern void unittest_printf(const char* format, ...);
+
+// blocks come back aligned to their size, and freeing them all coalesces back to where we were
+static bool test_buddy_alloc_free(void) {
+  BEGIN_TEST;
+
+  size_t before = ppc64_buddy_free_pages();
+  if (!before) {
+    unittest_printf("no buddy arena, skipped\n");
+    return true;
+  }
+
+  const size_t sizes[] = { 1, PAGE_SIZE, 3 * PAGE_SIZE, 64 << 10, 256 << 10, PAGE_SIZE, 16 << 20 };
+  void *block[countof(sizes)];
+  for (uint i = 0; i < countof(sizes); i++) {
+    block[i] = ppc64_buddy_alloc(sizes[i]);
+    if (!block[i]) continue;
+    size_t rounded = PAGE_SIZE;
+    while (rounded < sizes[i]) rounded <<= 1;
+    EXPECT_EQ(0UL, (uintptr_t)block[i] & (rounded - 1), "naturally aligned");
+    for (uint j = 0; j < i; j++) EXPECT_NE(block[j], block[i], "distinct blocks");
+  }
+  EXPECT_NONNULL(block[1], "a single page");
+
+  // out of order, so merges happen both into and out of the middle
+  for (uint i = 0; i < countof(sizes); i += 2) {
+    if (block[i]) ppc64_buddy_free(block[i], sizes[i]);
+  }
+  for (uint i = 1; i < countof(sizes); i += 2) {
+    if (block[i]) ppc64_buddy_free(block[i], sizes[i]);
+  }
+  EXPECT_EQ(before, ppc64_buddy_free_pages(), "all pages back");
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(ppc_buddy)
+RUN_TEST(test_buddy_alloc_free);
+END_TEST_CASE(ppc_buddy)
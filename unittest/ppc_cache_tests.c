@@ -0,0 +1,95 @@
+#include <lib/unittest.h>
+
+#include <arch/defines.h>
+#include <arch/ops.h>
+#include <arch/ppc64.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
+
+// partial lines at both ends go through plain stores, the bytes just outside must survive
+static bool test_cache_zero_range(void) {
+  BEGIN_TEST;
+
+  static uint8_t buf[CACHE_LINE * 6] __ALIGNED(CACHE_LINE);
+  const size_t offsets[] = { 0, 1, CACHE_LINE - 1, CACHE_LINE };
+  const size_t lens[] = { 1, CACHE_LINE - 1, CACHE_LINE, 3 * CACHE_LINE + 5 };
+
+  for (uint i = 0; i < countof(offsets); i++) {
+    for (uint j = 0; j < countof(lens); j++) {
+      memset(buf, 0xa5, sizeof(buf));
+      ppc64_cache_zero_range(buf + offsets[i], lens[j]);
+
+      bool ok = true;
+      for (size_t k = 0; k < sizeof(buf); k++) {
+        bool inside = k >= offsets[i] && k < offsets[i] + lens[j];
+        if (buf[k] != (inside ? 0 : 0xa5)) ok = false;
+      }
+      EXPECT_TRUE(ok, "only the range is zeroed");
+    }
+  }
+
+  END_TEST;
+}
+
+// cleaning and invalidating by line must not change what memory reads back
+static bool test_cache_maintenance_keeps_data(void) {
+  BEGIN_TEST;
+
+  static uint8_t buf[CACHE_LINE * 4] __ALIGNED(CACHE_LINE);
+  for (size_t i = 0; i < sizeof(buf); i++) buf[i] = i * 7;
+
+  arch_clean_cache_range((addr_t)buf + 3, sizeof(buf) - 5);
+  arch_clean_invalidate_cache_range((addr_t)buf, sizeof(buf));
+  arch_invalidate_cache_range((addr_t)buf + CACHE_LINE, CACHE_LINE);
+  arch_sync_cache_range((addr_t)buf, sizeof(buf));
+
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    if (buf[i] != (uint8_t)(i * 7)) ok = false;
+  }
+  EXPECT_TRUE(ok, "contents intact");
+
+  END_TEST;
+}
+
+#if WITH_KERNEL_VM
+// from the clean list or zeroed in place, either way no byte of the old contents survives
+static bool test_zero_pool(void) {
+  BEGIN_TEST;
+
+  // dirty a page and hand it back, the pmm is likely to give it out again next
+  vm_page_t *p = pmm_alloc_page();
+  ASSERT_NONNULL(p, "plain page");
+  memset(paddr_to_kvaddr(vm_page_to_paddr(p)), 0xa5, PAGE_SIZE);
+  pmm_free_page(p);
+
+  // with and without the idle loop having zeroed anything
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass) ppc64_zero_pool_idle();
+    vm_page_t *z = ppc64_pmm_alloc_page(PPC64_PMM_ALLOC_FLAG_ZEROED);
+    ASSERT_NONNULL(z, "zeroed page");
+    const uint64_t *w = paddr_to_kvaddr(vm_page_to_paddr(z));
+    bool ok = true;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(*w); i++) {
+      if (w[i]) ok = false;
+    }
+    EXPECT_TRUE(ok, "all zero");
+    pmm_free_page(z);
+  }
+
+  END_TEST;
+}
+#endif
+
+BEGIN_TEST_CASE(ppc_cache)
+RUN_TEST(test_cache_zero_range);
+RUN_TEST(test_cache_maintenance_keeps_data);
+#if WITH_KERNEL_VM
+RUN_TEST(test_zero_pool);
+#endif
+END_TEST_CASE(ppc_cache)
@@ -0,0 +1,161 @@
+#include <lib/unittest.h>
+
+#include <arch/ppc64.h>
+#include <lk/compiler.h>
+#include <lk/err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// a small tree shaped like qemu pseries': RMA and the rest of RAM as two memory nodes, two
+// cpu nodes of two threads each, an RTAS node and one reservation
+static uint32_t dt_struct[128];
+static uint dt_words;
+static char dt_strings[256];
+static uint dt_strings_len;
+static uint64_t blob[128];
+
+static uint dt_string(const char *s) {
+  for (uint off = 0; off < dt_strings_len; off += strlen(dt_strings + off) + 1) {
+    if (!strcmp(dt_strings + off, s)) return off;
+  }
+  uint off = dt_strings_len;
+  strcpy(dt_strings + off, s);
+  dt_strings_len += strlen(s) + 1;
+  return off;
+}
+
+static void dt_begin(const char *name) {
+  dt_struct[dt_words++] = 1;
+  uint words = strlen(name) / 4 + 1;
+  memset(&dt_struct[dt_words], 0, words * 4);
+  memcpy(&dt_struct[dt_words], name, strlen(name));
+  dt_words += words;
+}
+
+static void dt_prop(const char *name, const uint32_t *val, uint count) {
+  dt_struct[dt_words++] = 3;
+  dt_struct[dt_words++] = count * 4;
+  dt_struct[dt_words++] = dt_string(name);
+  memcpy(&dt_struct[dt_words], val, count * 4);
+  dt_words += count;
+}
+
+#define DT_PROP(name, ...) \
+  do { \
+    const uint32_t v[] = { __VA_ARGS__ }; \
+    dt_prop(name, v, countof(v)); \
+  } while (0)
+
+static void dt_end(void) {
+  dt_struct[dt_words++] = 2;
+}
+
+// header, reservation block, structure block, strings
+static void dt_build(void) {
+  dt_words = 0;
+  dt_strings_len = 0;
+
+  dt_begin("");
+  DT_PROP("#address-cells", 2);
+  DT_PROP("#size-cells", 2);
+  dt_begin("memory@0");
+  DT_PROP("reg", 0, 0, 0, 0x20000000);
+  dt_end();
+  dt_begin("memory@20000000");
+  DT_PROP("reg", 0, 0x20000000, 0, 0xe0000000);
+  dt_end();
+  dt_begin("cpus");
+  DT_PROP("#address-cells", 1);
+  dt_begin("PowerPC,970@0");
+  DT_PROP("ibm,ppc-interrupt-server#s", 0, 1);
+  DT_PROP("timebase-frequency", 512000000);
+  DT_PROP("d-cache-line-size", 64);
+  DT_PROP("d-cache-block-size", 128);
+  DT_PROP("i-cache-line-size", 64);
+  DT_PROP("slb-size", 64);
+  DT_PROP("ibm,pft-size", 0, 22);
+  dt_end();
+  dt_begin("PowerPC,970@2");
+  DT_PROP("ibm,ppc-interrupt-server#s", 2, 3);
+  DT_PROP("timebase-frequency", 1);
+  dt_end();
+  dt_end();
+  dt_begin("rtas");
+  DT_PROP("start-cpu", 0x2007);
+  dt_end();
+  dt_end();
+  dt_struct[dt_words++] = 9;
+
+  memset(blob, 0, sizeof(blob));
+  uint32_t *h = (uint32_t *)blob;
+  uint64_t *rsv = &blob[5];
+  rsv[0] = 0x1ff00000;
+  rsv[1] = 0x10000;
+  uint32_t off_struct = 9 * 8;
+  uint32_t off_strings = off_struct + dt_words * 4;
+  uint32_t total = off_strings + dt_strings_len;
+  memcpy((uint8_t *)blob + off_struct, dt_struct, dt_words * 4);
+  memcpy((uint8_t *)blob + off_strings, dt_strings, dt_strings_len);
+
+  h[0] = 0xd00dfeed;
+  h[1] = total;
+  h[2] = off_struct;
+  h[3] = off_strings;
+  h[4] = 5 * 8;
+  h[5] = 17;
+  h[6] = 16;
+  h[8] = dt_strings_len;
+  h[9] = dt_words * 4;
+}
+
+static bool test_fdt_parse(void) {
+  BEGIN_TEST;
+
+  dt_build();
+  ASSERT_TRUE(((uint32_t *)blob)[1] <= sizeof(blob), "tree fits");
+
+  struct ppc64_fdt_info info;
+  ASSERT_EQ(NO_ERROR, ppc64_fdt_parse(blob, &info), "parses");
+  EXPECT_EQ(2u, info.mem_count, "both memory nodes");
+  EXPECT_EQ(0ULL, info.mem[0].base, "rma base");
+  EXPECT_EQ(0x20000000ULL, info.mem[0].size, "rma size, two size cells");
+  EXPECT_EQ(0x20000000ULL, info.mem[1].base, "second node");
+  EXPECT_EQ(0xe0000000ULL, info.mem[1].size, "4G in all");
+  EXPECT_EQ(1u, info.rsv_count, "one reservation");
+  EXPECT_EQ(0x1ff00000ULL, info.rsv[0].base, "reservation");
+  EXPECT_EQ(4u, info.cpus, "two threads per cpu node");
+  EXPECT_EQ(512000000ULL, info.timebase_freq, "first cpu's timebase");
+  EXPECT_EQ(128u, info.dcache_line, "block size over line size");
+  EXPECT_EQ(64u, info.icache_line, "line size without a block size");
+  EXPECT_EQ(64u, info.slb_size, "slb size");
+  EXPECT_EQ(22u, info.pft_shift, "pft size");
+  EXPECT_EQ(0x2007u, info.rtas_start_cpu, "rtas token");
+
+  END_TEST;
+}
+
+static bool test_fdt_reject(void) {
+  BEGIN_TEST;
+
+  struct ppc64_fdt_info info;
+  uint32_t *h = (uint32_t *)blob;
+
+  dt_build();
+  h[0] = 0xfeedd00d;
+  EXPECT_EQ(ERR_NOT_VALID, ppc64_fdt_parse(blob, &info), "bad magic");
+  EXPECT_EQ(0u, info.mem_count, "nothing kept");
+
+  // cut off before FDT_END
+  dt_build();
+  h[1] = h[3] - 8;
+  h[3] = h[1] - 4;
+  EXPECT_TRUE(ppc64_fdt_parse(blob, &info) < 0, "truncated");
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(ppc_fdt)
+RUN_TEST(test_fdt_parse);
+RUN_TEST(test_fdt_reject);
+END_TEST_CASE(ppc_fdt)
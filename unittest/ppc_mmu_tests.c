@@ -0,0 +1,159 @@
+#include <lib/unittest.h>
+
+#include <arch/cpu_regs.h>
+#include <arch/defines.h>
+#include <arch/mmu.h>
+#include <arch/ppc64.h>
+#include <lk/err.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// a private aspace well clear of the kernel, the HPT entries it creates are gone again on unmap
+#define TEST_BASE 0x40000000UL
+#define TEST_SIZE 0x40000000UL
+
+static bool test_mmu_map_query_unmap(void) {
+  BEGIN_TEST;
+
+  arch_aspace_t aspace;
+  ASSERT_EQ(NO_ERROR, arch_mmu_init_aspace(&aspace, TEST_BASE, TEST_SIZE, 0), "init aspace");
+
+  paddr_t pa;
+  uint flags;
+  EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(&aspace, TEST_BASE, &pa, &flags), "empty aspace");
+
+  EXPECT_EQ(0, arch_mmu_map(&aspace, TEST_BASE, 0x100000, 3, ARCH_MMU_FLAG_PERM_RO), "map 3 pages");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&aspace, TEST_BASE + 0x1234, &pa, &flags), "query mapped");
+  EXPECT_EQ(0x101234UL, pa, "offset carried through");
+  EXPECT_EQ((uint)ARCH_MMU_FLAG_PERM_RO, flags, "flags carried through");
+
+  // a segment boundary, the next vsid and a different hash
+  vaddr_t seg = TEST_BASE + 0x10000000UL - PAGE_SIZE;
+  EXPECT_EQ(0, arch_mmu_map(&aspace, seg, 0x200000, 2, 0), "map across a segment");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&aspace, seg + PAGE_SIZE, &pa, &flags), "query second segment");
+  EXPECT_EQ(0x201000UL, pa, "second segment address");
+
+  EXPECT_EQ(0, arch_mmu_unmap(&aspace, TEST_BASE + PAGE_SIZE, 1), "unmap the middle page");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&aspace, TEST_BASE, &pa, &flags), "first page kept");
+  EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(&aspace, TEST_BASE + PAGE_SIZE, &pa, &flags), "middle page gone");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&aspace, TEST_BASE + 2 * PAGE_SIZE, &pa, &flags), "last page kept");
+
+  EXPECT_LT(arch_mmu_map(&aspace, TEST_BASE + TEST_SIZE, 0x100000, 1, 0), 0, "outside the aspace");
+
+  arch_mmu_unmap(&aspace, TEST_BASE, 3);
+  arch_mmu_unmap(&aspace, seg, 2);
+  EXPECT_EQ(NO_ERROR, arch_mmu_destroy_aspace(&aspace), "destroy");
+
+  END_TEST;
+}
+
+// a range with holes where whole leaf tables are missing, walked a table at a time
+static bool test_mmu_unmap_sparse(void) {
+  BEGIN_TEST;
+
+  arch_aspace_t aspace;
+  ASSERT_EQ(NO_ERROR, arch_mmu_init_aspace(&aspace, TEST_BASE, TEST_SIZE, 0), "init aspace");
+
+  // a leaf table covers 2MB, the pages sit in the first and fourth and just past the range
+  const vaddr_t first = TEST_BASE + PAGE_SIZE;
+  const vaddr_t last = TEST_BASE + 3 * 0x200000UL + 5 * PAGE_SIZE;
+  const uint count = 4 * 0x200000UL / PAGE_SIZE;
+  const vaddr_t past = TEST_BASE + count * PAGE_SIZE;
+  EXPECT_EQ(0, arch_mmu_map(&aspace, first, 0x100000, 1, 0), "map first");
+  EXPECT_EQ(0, arch_mmu_map(&aspace, last, 0x200000, 1, 0), "map last");
+  EXPECT_EQ(0, arch_mmu_map(&aspace, past, 0x300000, 1, 0), "map past the range");
+
+  EXPECT_EQ(0, arch_mmu_unmap(&aspace, TEST_BASE, count), "unmap 8MB");
+  paddr_t pa;
+  EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(&aspace, first, &pa, NULL), "first gone");
+  EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(&aspace, last, &pa, NULL), "last gone");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&aspace, past, &pa, NULL), "the page after kept");
+
+  arch_mmu_unmap(&aspace, past, 1);
+  EXPECT_EQ(NO_ERROR, arch_mmu_destroy_aspace(&aspace), "destroy");
+
+  END_TEST;
+}
+
+// same va in two aspaces, each has its own vsids so both translations live in the HPT at once
+static bool test_mmu_contexts(void) {
+  BEGIN_TEST;
+
+  arch_aspace_t a, b;
+  ASSERT_EQ(NO_ERROR, arch_mmu_init_aspace(&a, TEST_BASE, TEST_SIZE, 0), "init a");
+  ASSERT_EQ(NO_ERROR, arch_mmu_init_aspace(&b, TEST_BASE, TEST_SIZE, 0), "init b");
+  EXPECT_NE(ppc64_mmu_vsid(&a, TEST_BASE), ppc64_mmu_vsid(&b, TEST_BASE), "distinct vsids");
+  EXPECT_NE(ppc64_mmu_vsid(&a, TEST_BASE), ppc64_mmu_vsid(ppc64_mmu_kernel_aspace(), TEST_BASE),
+      "distinct from the kernel");
+
+  EXPECT_EQ(0, arch_mmu_map(&a, TEST_BASE, 0x100000, 1, 0), "map a");
+  EXPECT_EQ(0, arch_mmu_map(&b, TEST_BASE, 0x200000, 1, 0), "map b");
+
+  paddr_t pa;
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&a, TEST_BASE, &pa, NULL), "query a");
+  EXPECT_EQ(0x100000UL, pa, "a kept its page");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(&b, TEST_BASE, &pa, NULL), "query b");
+  EXPECT_EQ(0x200000UL, pa, "b kept its page");
+
+  arch_mmu_unmap(&a, TEST_BASE, 1);
+  arch_mmu_unmap(&b, TEST_BASE, 1);
+  EXPECT_EQ(NO_ERROR, arch_mmu_destroy_aspace(&a), "destroy a");
+  EXPECT_EQ(NO_ERROR, arch_mmu_destroy_aspace(&b), "destroy b");
+
+  END_TEST;
+}
+
+#if WITH_KERNEL_VM
+// reads map the shared zero page read only, the first store brings in a page of its own
+static bool test_mmu_lazy(void) {
+  BEGIN_TEST;
+
+  // lazy addresses only mean something with translation on, in real mode there are none
+  if (!(msr_read() & MSR_DR)) {
+    EXPECT_TRUE(ppc64_lazy_alloc(PAGE_SIZE, 0) == NULL, "no lazy memory in real mode");
+    unittest_printf("translation off, rest skipped\n");
+    END_TEST;
+  }
+
+  volatile uint8_t *p = ppc64_lazy_alloc(4 * PAGE_SIZE, 0);
+  ASSERT_NONNULL((void *)p, "lazy alloc");
+
+  arch_aspace_t *kernel = ppc64_mmu_kernel_aspace();
+  paddr_t pa, zero;
+  uint flags;
+  EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(kernel, (vaddr_t)p, &pa, &flags), "nothing before a touch");
+
+  EXPECT_EQ(0, p[0], "reads zero");
+  EXPECT_EQ(0, p[PAGE_SIZE], "second page reads zero");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(kernel, (vaddr_t)p, &zero, &flags), "read mapped");
+  EXPECT_TRUE(flags & ARCH_MMU_FLAG_PERM_RO, "read only");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(kernel, (vaddr_t)p + PAGE_SIZE, &pa, NULL), "second read mapped");
+  EXPECT_EQ(zero, pa, "one zero page for both");
+
+  p[1] = 0x5a;
+  EXPECT_EQ(0x5a, p[1], "store kept");
+  EXPECT_EQ(0, p[0], "rest of the page still zero");
+  EXPECT_EQ(NO_ERROR, arch_mmu_query(kernel, (vaddr_t)p, &pa, &flags), "written page mapped");
+  EXPECT_NE(zero, pa, "a page of its own");
+  EXPECT_FALSE(flags & ARCH_MMU_FLAG_PERM_RO, "writable");
+  EXPECT_EQ(0, p[PAGE_SIZE], "the other page still reads zero");
+
+  // a store to a page nobody read goes straight to a fresh page
+  p[3 * PAGE_SIZE] = 1;
+  EXPECT_EQ(1, p[3 * PAGE_SIZE], "store without a read first");
+
+  ppc64_lazy_free((void *)p);
+  EXPECT_EQ(ERR_NOT_FOUND, arch_mmu_query(kernel, (vaddr_t)p, &pa, NULL), "unmapped on free");
+
+  END_TEST;
+}
+#endif
+
+BEGIN_TEST_CASE(ppc_mmu)
+RUN_TEST(test_mmu_map_query_unmap);
+RUN_TEST(test_mmu_unmap_sparse);
+RUN_TEST(test_mmu_contexts);
+#if WITH_KERNEL_VM
+RUN_TEST(test_mmu_lazy);
+#endif
+END_TEST_CASE(ppc_mmu)
@@ -0,0 +1,79 @@
+#include <lib/unittest.h>
+
+#include <arch/cpu_regs.h>
+#include <arch/ops.h>
+#include <arch/paca.h>
+#include <kernel/event.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// r13 is this cpu's paca and the accessors agree with the struct
+static bool test_paca_self(void) {
+  BEGIN_TEST;
+
+  spin_lock_saved_state_t state;
+  arch_interrupt_save(&state, SPIN_LOCK_FLAG_INTERRUPTS);
+  uint cpu = arch_curr_cpu_num();
+  struct ppc64_paca *paca = ppc64_paca();
+  uint64_t pir = pir_read();
+  arch_interrupt_restore(state, SPIN_LOCK_FLAG_INTERRUPTS);
+
+  EXPECT_EQ(&ppc64_pacas[cpu], paca, "r13 is this cpu's");
+  EXPECT_EQ((uint64_t)cpu, pir, "cpu number is PIR");
+  EXPECT_EQ(get_current_thread(), paca->current_thread, "current thread");
+  EXPECT_EQ(0UL, (uintptr_t)paca & (CACHE_LINE - 1), "a line of its own");
+  EXPECT_NE(0ULL, paca->irq_sp, "interrupt stack");
+
+  END_TEST;
+}
+
+// the decrementer keeps ticking through the fast path, on the interrupt stack, while we sleep
+static bool test_paca_irqs(void) {
+  BEGIN_TEST;
+
+  uint64_t before = 0, after = 0;
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) before += ppc64_pacas[cpu].irqs;
+  thread_sleep(20);
+  for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) after += ppc64_pacas[cpu].irqs;
+  EXPECT_TRUE(after > before, "fast path entries counted");
+
+  END_TEST;
+}
+
+static event_t msr_event;
+
+static int msr_waiter(void *arg) {
+  event_wait(&msr_event);
+  *(uint64_t *)arg = msr_read() & (MSR_IR | MSR_DR);
+  return 0;
+}
+
+// translation belongs to the thread, the decrementer's preempts run in real mode and must not
+// hand that to a thread that blocked translated
+static bool test_paca_msr(void) {
+  BEGIN_TEST;
+
+  uint64_t msr = msr_read() & (MSR_IR | MSR_DR);
+  uint64_t woken = ~0ULL;
+  event_init(&msr_event, false, 0);
+  thread_t *t = thread_create("msr waiter", msr_waiter, &woken, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+  ASSERT_NE(NULL, t, "thread");
+  thread_resume(t);
+
+  thread_sleep(20);
+  EXPECT_EQ(msr, msr_read() & (MSR_IR | MSR_DR), "same translation after sleeping");
+  event_signal(&msr_event, true);
+  thread_join(t, NULL, INFINITE_TIME);
+  EXPECT_EQ(msr, woken, "a blocked thread wakes with its creator's translation");
+  event_destroy(&msr_event);
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(ppc_paca)
+RUN_TEST(test_paca_self);
+RUN_TEST(test_paca_irqs);
+RUN_TEST(test_paca_msr);
+END_TEST_CASE(ppc_paca)
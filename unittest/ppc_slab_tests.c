@@ -0,0 +1,61 @@
+#include <lib/unittest.h>
+
+#include <arch/defines.h>
+#include <arch/ppc64.h>
+#include <lk/compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// every object starts on its own line and no two live objects overlap
+static bool test_slab_classes(void) {
+  BEGIN_TEST;
+
+  const size_t sizes[] = { 0, 1, CACHE_LINE, CACHE_LINE + 1, 1000, 2048, 2049, 3 * PAGE_SIZE };
+  void *obj[countof(sizes)];
+
+  for (uint i = 0; i < countof(sizes); i++) {
+    obj[i] = ppc64_slab_alloc(sizes[i]);
+    ASSERT_NONNULL(obj[i], "alloc");
+    EXPECT_EQ(0UL, (uintptr_t)obj[i] & (CACHE_LINE - 1), "line aligned");
+    memset(obj[i], i + 1, sizes[i] ? sizes[i] : 1);
+  }
+  for (uint i = 0; i < countof(sizes); i++) {
+    const uint8_t *p = obj[i];
+    bool ok = true;
+    for (size_t k = 0; k < (sizes[i] ? sizes[i] : 1); k++) {
+      if (p[k] != (uint8_t)(i + 1)) ok = false;
+    }
+    EXPECT_TRUE(ok, "contents survive the other allocations");
+    ppc64_slab_free(obj[i]);
+  }
+
+  END_TEST;
+}
+
+// enough objects to spill several magazines and grow and then release slabs
+static bool test_slab_churn(void) {
+  BEGIN_TEST;
+
+  static void *obj[1024];
+  for (uint round = 0; round < 3; round++) {
+    for (uint i = 0; i < countof(obj); i++) {
+      obj[i] = ppc64_slab_alloc(CACHE_LINE);
+      ASSERT_NONNULL(obj[i], "alloc");
+      *(uint *)obj[i] = i;
+    }
+    bool ok = true;
+    for (uint i = 0; i < countof(obj); i++) {
+      if (*(uint *)obj[i] != i) ok = false;
+    }
+    EXPECT_TRUE(ok, "no object handed out twice");
+    for (uint i = 0; i < countof(obj); i++) ppc64_slab_free(obj[i]);
+  }
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(ppc_slab)
+RUN_TEST(test_slab_classes);
+RUN_TEST(test_slab_churn);
+END_TEST_CASE(ppc_slab)
@@ -0,0 +1,80 @@
+#include <lib/unittest.h>
+
+#include <arch/spinlock.h>
+#include <kernel/thread.h>
+#include <lk/debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONTENDERS 6
+#define ITERATIONS 10000
+
+static bool test_spinlock_basic(void) {
+  BEGIN_TEST;
+
+  spin_lock_t lock = SPIN_LOCK_INITIAL_VALUE;
+  EXPECT_FALSE(arch_spin_lock_held(&lock), "free after init");
+
+  arch_spin_lock(&lock);
+  EXPECT_TRUE(arch_spin_lock_held(&lock), "held after lock");
+  EXPECT_NE(0, arch_spin_trylock(&lock), "trylock of a held lock");
+  arch_spin_unlock(&lock);
+  EXPECT_FALSE(arch_spin_lock_held(&lock), "free after unlock");
+
+  EXPECT_EQ(0, arch_spin_trylock(&lock), "trylock of a free lock");
+  EXPECT_TRUE(arch_spin_lock_held(&lock), "held after trylock");
+  arch_spin_unlock(&lock);
+
+  END_TEST;
+}
+
+static bool test_spinlock_ticket_wrap(void) {
+  BEGIN_TEST;
+
+  // next ticket and owner both at the top of the halfword, the next acquire wraps both
+  spin_lock_t lock = 0xffffffff;
+  EXPECT_FALSE(arch_spin_lock_held(&lock), "free before wrap");
+  arch_spin_lock(&lock);
+  EXPECT_EQ(0x0000ffffU, lock, "ticket wrapped");
+  arch_spin_unlock(&lock);
+  EXPECT_EQ(0U, lock, "owner wrapped");
+
+  END_TEST;
+}
+
+static spin_lock_t contended_lock = SPIN_LOCK_INITIAL_VALUE;
+static volatile uint64_t contended_counter;
+
+static int contender(void *arg) {
+  for (int i = 0; i < ITERATIONS; i++) {
+    spin_lock_saved_state_t state;
+    spin_lock_irqsave(&contended_lock, state);
+    contended_counter++;
+    spin_unlock_irqrestore(&contended_lock, state);
+  }
+  return 0;
+}
+
+static bool test_spinlock_contended(void) {
+  BEGIN_TEST;
+
+  thread_t *threads[CONTENDERS];
+  contended_counter = 0;
+  for (int i = 0; i < CONTENDERS; i++) {
+    threads[i] = thread_create("contender", contender, NULL, DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_resume(threads[i]);
+  }
+  for (int i = 0; i < CONTENDERS; i++) {
+    thread_join(threads[i], NULL, INFINITE_TIME);
+  }
+  EXPECT_EQ((uint64_t)CONTENDERS * ITERATIONS, contended_counter, "no lost increments");
+  EXPECT_FALSE(arch_spin_lock_held(&contended_lock), "free after all contenders");
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(ppc_spinlock)
+RUN_TEST(test_spinlock_basic);
+RUN_TEST(test_spinlock_ticket_wrap);
+RUN_TEST(test_spinlock_contended);
+END_TEST_CASE(ppc_spinlock)
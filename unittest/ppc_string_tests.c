@@ -0,0 +1,122 @@
+#include <lib/unittest.h>
+
+#include <arch/defines.h>
+#include <lk/compiler.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+// every size class at every alignment mod 16, against byte loops, with guard bytes around
+// the destination. 3 lines and VMX_MIN + a bit reach the dcbz and vmx paths
+static const size_t lens[] = { 0, 1, 7, 15, 16, 31, 3 * CACHE_LINE + 9, 4096 + 77 };
+
+#define GUARD 32
+static uint8_t src[4096 + 256] __ALIGNED(CACHE_LINE);
+static uint8_t dst[4096 + 256] __ALIGNED(CACHE_LINE);
+
+static void fill(void) {
+  for (size_t i = 0; i < sizeof(src); i++) src[i] = i * 13 + 5;
+  memset(dst, 0xa5, sizeof(dst));
+}
+
+static bool dst_is(size_t off, size_t len, const uint8_t *expect, int c) {
+  for (size_t k = 0; k < sizeof(dst); k++) {
+    bool inside = k >= GUARD + off && k < GUARD + off + len;
+    uint8_t want = !inside ? 0xa5 : expect ? expect[k - GUARD - off] : (uint8_t)c;
+    if (dst[k] != want) return false;
+  }
+  return true;
+}
+
+static bool test_memcpy(void) {
+  BEGIN_TEST;
+
+  for (size_t so = 0; so < 16; so++) {
+    for (size_t d = 0; d < 16; d++) {
+      for (uint i = 0; i < countof(lens); i++) {
+        fill();
+        memcpy(dst + GUARD + d, src + so, lens[i]);
+        EXPECT_TRUE(dst_is(d, lens[i], src + so, 0), "copied, guards intact");
+      }
+    }
+  }
+
+  END_TEST;
+}
+
+static bool test_memset(void) {
+  BEGIN_TEST;
+
+  for (size_t d = 0; d < 16; d++) {
+    for (uint i = 0; i < countof(lens); i++) {
+      fill();
+      memset(dst + GUARD + d, 0, lens[i]);
+      EXPECT_TRUE(dst_is(d, lens[i], NULL, 0), "zeroed, guards intact");
+
+      fill();
+      memset(dst + GUARD + d, 0x3c, lens[i]);
+      EXPECT_TRUE(dst_is(d, lens[i], NULL, 0x3c), "filled, guards intact");
+    }
+  }
+
+  END_TEST;
+}
+
+// overlapping both ways by less than a line and by more, against a copy made first
+static bool test_memmove(void) {
+  BEGIN_TEST;
+
+  static uint8_t expect[sizeof(src)];
+  const ssize_t shifts[] = { -CACHE_LINE - 3, -8, -1, 1, 8, CACHE_LINE + 3 };
+
+  for (uint i = 0; i < countof(shifts); i++) {
+    for (uint j = 0; j < countof(lens); j++) {
+      size_t len = lens[j];
+      if (len > 4096) continue;
+      uint8_t *from = src + 2 * CACHE_LINE;
+      uint8_t *to = from + shifts[i];
+
+      fill();
+      for (size_t k = 0; k < len; k++) expect[k] = from[k];
+      memmove(to, from, len);
+
+      bool ok = true;
+      for (size_t k = 0; k < len; k++) {
+        if (to[k] != expect[k]) ok = false;
+      }
+      EXPECT_TRUE(ok, "overlapping move");
+    }
+  }
+
+  END_TEST;
+}
+
+static bool test_memcmp(void) {
+  BEGIN_TEST;
+
+  for (uint i = 0; i < countof(lens); i++) {
+    size_t len = lens[i];
+    fill();
+    memcpy(dst, src, len);
+    EXPECT_EQ(0, memcmp(dst, src, len), "equal");
+    if (!len) continue;
+
+    // the wide loops must still report the first difference, not a later one
+    src[len - 1] = 0x00;
+    dst[len - 1] = 0xff;
+    src[len / 2] = 0x80;
+    dst[len / 2] = 0x7f;
+    EXPECT_TRUE(memcmp(dst, src, len) < 0, "sign of the first difference");
+    EXPECT_TRUE(memcmp(src, dst, len) > 0, "and the other way");
+  }
+
+  END_TEST;
+}
+
+BEGIN_TEST_CASE(ppc_string)
+RUN_TEST(test_memcpy);
+RUN_TEST(test_memset);
+RUN_TEST(test_memmove);
+RUN_TEST(test_memcmp);
+END_TEST_CASE(ppc_string)
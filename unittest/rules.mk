@@ -4,11 +4,19 @@ MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS := \
 	$(LOCAL_DIR)/ppc_alu_tests.c \
+	$(LOCAL_DIR)/ppc_buddy_tests.c \
+	$(LOCAL_DIR)/ppc_cache_tests.c \
 	$(LOCAL_DIR)/ppc_cmp_tests.c \
+	$(LOCAL_DIR)/ppc_fdt_tests.c \
 	$(LOCAL_DIR)/ppc_fpu_tests.c \
 	$(LOCAL_DIR)/ppc_logical_tests.c \
+	$(LOCAL_DIR)/ppc_mmu_tests.c \
+	$(LOCAL_DIR)/ppc_paca_tests.c \
 	$(LOCAL_DIR)/ppc_rotate_tests.c \
 	$(LOCAL_DIR)/ppc_shift_tests.c \
+	$(LOCAL_DIR)/ppc_slab_tests.c \
+	$(LOCAL_DIR)/ppc_spinlock_tests.c \
+	$(LOCAL_DIR)/ppc_string_tests.c \
 	$(LOCAL_DIR)/ppc_vpu_tests.c \
 
 MODULES += lib/unittest